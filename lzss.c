@@ -41,14 +41,39 @@
 *                             INCLUDED FILES
 ***************************************************************************/
 #include <unistd.h>
+/* For getopt_long */
+#include <getopt.h>
 #include <stdio.h>
 /* For setmode */
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+/* For EINTR */
+#include <errno.h>
+/* For uint32_t */
+#include <stdint.h>
+/* For LONG_MAX */
+#include <limits.h>
 
 #ifdef _WIN32
 /* For _O_BINARY */
 #include <io.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+/* For mmap and madvise */
+#include <sys/mman.h>
+#endif
+
+/* For stat and fstat */
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* SSE2/AVX2 kernels, selected at run time */
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+/* For the SHA extensions bit */
+#include <cpuid.h>
 #endif
 
 
@@ -66,9 +91,313 @@ typedef struct encoded_string_t
 typedef enum
 {
     ENCODE,
-    DECODE
+    DECODE,
+    PROBE
 } MODES;
 
+/* command line options with only a long form */
+typedef enum
+{
+    OPT_SIZE = 256,     /* --size, past any short option character */
+    OPT_PROBE,          /* --probe */
+    OPT_CRC32,          /* --crc32 */
+    OPT_SHA256,         /* --sha256 */
+    OPT_INDEX,          /* --index */
+    OPT_RANGE,          /* --range */
+    OPT_BATCH,          /* --batch */
+    OPT_MANIFEST        /* --manifest */
+} LONG_OPTIONS;
+
+/* methods for locating candidate matches in the window */
+typedef enum
+{
+    ENGINE_BRUTE,   /* test every distance, the original eb_ecl.exe loop */
+    ENGINE_CHAIN,   /* only test distances on the 3 byte hash chain */
+    ENGINE_SIMD,    /* test distances found by a vector compare of 3 bytes */
+    ENGINE_SHIFTAND,    /* track every distance at once in a bit vector */
+    ENGINE_SUFFIX       /* walk the window in a suffix array of the input */
+} ENGINES;
+
+/* returns bit j set if block[j..j+2] matches the first 3 bytes of current */
+typedef unsigned long (*candidate_mask_t)(const unsigned char *block,
+    const unsigned char *current);
+
+/* returns the number of leading bytes, up to maxLen, that a and b share */
+typedef int (*match_length_t)(const unsigned char *a, const unsigned char *b,
+    int maxLen);
+
+/* runs the SHA-256 compression function over blocks 64 byte blocks */
+typedef void (*sha256_blocks_t)(uint32_t *state, const unsigned char *data,
+    long blocks);
+
+/* suffixes of the whole input sorted by their first MAX_LENGTH + 1 bytes */
+typedef struct suffix_index_t
+{
+    unsigned int *array;        /* positions in sorted suffix order */
+    unsigned int *rank;         /* place of each position in array */
+    unsigned char *lcp;         /* bytes shared with the previous suffix */
+    unsigned char *lcpMin64;    /* smallest lcp in each block of 64 */
+    unsigned char *lcpMin4096;  /* smallest lcp in each block of 4096 */
+} suffix_index_t;
+
+/* match search state for an input held entirely in memory */
+typedef struct match_finder_t
+{
+    ENGINES engine;             /* method used to find candidates */
+    const unsigned char *data;  /* input being encoded */
+    long size;                  /* number of bytes in data */
+    long nextInsert;            /* next position to add to the hash chains */
+    long *hashHead;             /* most recent position for each hash */
+    long *hashPrev;             /* previous position with the same hash */
+    unsigned long long *byteBits;   /* positions holding each byte value */
+    long bitsLow;               /* oldest position in byteBits */
+    long bitsHigh;              /* next position to add to byteBits */
+    unsigned short *gramCount;  /* occurrences of each 3 byte string hash */
+    long gramLow;               /* oldest position counted in gramCount */
+    long gramHigh;              /* next position to count in gramCount */
+    long runStart;              /* first position of the last byte run seen */
+    long runEnd;                /* position following the last byte run */
+    int runClosed;              /* FALSE if the run may go past runEnd */
+    int period;                 /* period of the last repeating region */
+    long periodStart;           /* first position of the repeating region */
+    long periodEnd;             /* position following the repeating region */
+    int periodClosed;           /* FALSE if the region may go past periodEnd */
+    long periodCheck;           /* position to look for a new period at */
+    int periodOffset;           /* offset of the match ending there */
+    suffix_index_t *suffixIndex;    /* sorted suffixes of data */
+    int ownsIndex;              /* TRUE if suffixIndex is freed with this */
+    unsigned long long *windowRanks;    /* ranks of the window positions */
+    unsigned long long *windowWords;    /* non-empty words of windowRanks */
+    long windowLow;             /* oldest position in windowRanks */
+    long windowHigh;            /* next position to add to windowRanks */
+} match_finder_t;
+
+/* decoder states at intervals through a stream, see AddCheckpoint */
+typedef struct checkpoint_index_t
+{
+    long interval;          /* decoded bytes between checkpoints */
+    long count;             /* number of checkpoints */
+    long capacity;          /* checkpoints there is room for */
+    long next;              /* decoded position due a checkpoint next */
+    long *positions;        /* decoded and encoded position of each */
+    unsigned char *windows; /* the WINDOW_SIZE decoded bytes before each */
+    int failed;             /* TRUE if memory ran out adding one */
+} checkpoint_index_t;
+
+/* encoder settings taken from the command line */
+typedef struct encode_options_t
+{
+    int dontPad;        /* don't pad output to a multiple of 0x10 */
+    int exactPad;       /* padding must decode as no-op commands */
+    ENGINES engine;     /* match finder to use */
+    int verify;         /* compare every match against the brute force scan */
+    int threads;        /* threads used to find matches */
+    checkpoint_index_t *index;  /* index to add checkpoints to, or NULL */
+    const char *name;   /* input named in the messages printed, or NULL */
+} encode_options_t;
+
+/* one file of a batch, see EncodeBatch */
+typedef struct batch_file_t
+{
+    const char *inName; /* file to encode */
+    char *outName;      /* file to write, freed with the batch */
+    long size;          /* bytes in the input, or -1 if it can't be read */
+    int failed;         /* TRUE if the file couldn't be encoded */
+} batch_file_t;
+
+/* files encoded by EncodeBatch, each on one thread */
+typedef struct batch_t
+{
+    batch_file_t *files;    /* files in the batch */
+    long count;             /* number of files */
+    long capacity;          /* files there is room for */
+    char *manifest;         /* text of the manifest the names are in */
+    const encode_options_t *options;    /* settings for every file */
+} batch_t;
+
+/* decoder settings taken from the command line */
+typedef struct decode_options_t
+{
+    long size;          /* bytes to decode, or -1 to decode everything */
+    int threads;        /* threads decoding chunks of the input */
+    int digests;        /* DIGEST_ bits of the digests to report */
+    checkpoint_index_t *index;  /* index to add checkpoints to, or to seek */
+                                /* with for a range, or NULL */
+    long rangeStart;    /* first decoded byte of the range to decode */
+    long rangeLength;   /* bytes in the range, or -1 to decode everything */
+} decode_options_t;
+
+/* digests of decoded data computed as it is decoded, see UpdateDigest */
+typedef struct digest_t
+{
+    int digests;                /* DIGEST_ bits of the digests computed */
+    uint32_t crc;               /* CRC-32 so far, inverted */
+    uint32_t state[8];          /* SHA-256 state after the whole blocks */
+    unsigned char block[64];    /* bytes of the last, incomplete block */
+    int blockSize;              /* bytes in block */
+    unsigned long long length;  /* bytes hashed */
+} digest_t;
+
+/* where a decode stopped, see DecodeLZSSPartial */
+typedef struct decode_end_t
+{
+    long inPos;             /* next input byte to read */
+    unsigned char flags;    /* flag byte of the group being decoded */
+    unsigned char flagPos;  /* flag bit of the next token, 0 after the */
+                            /* last token of the group */
+    int overrun;            /* TRUE if a token didn't fit in the output */
+} decode_end_t;
+
+/* decoder fed encoded data as it arrives, see DrainStreamDecoder */
+typedef struct stream_decoder_t
+{
+    unsigned char *window;      /* decoded bytes, following the bytes */
+                                /* matches can still read */
+    long windowPos;             /* next byte of window to decode to */
+    long drainPos;              /* next byte of window to drain */
+    const unsigned char *input; /* data from the last feed */
+    long inputSize;             /* bytes of data in input */
+    long inputPos;              /* next byte of input to decode */
+    unsigned char flags;        /* flag byte of the group being decoded */
+    unsigned char flagPos;      /* flag bit of the next token, 0 before */
+                                /* a flag byte */
+    int carried;                /* TRUE if carry is the first byte of a */
+    unsigned char carry;        /* code split between feeds */
+    digest_t *digest;           /* updated with the bytes drained, or */
+                                /* NULL, set by the caller */
+    checkpoint_index_t *index;  /* given a checkpoint at group boundaries */
+                                /* when due, or NULL, set by the caller */
+    long decodedBase;           /* decoded position of window[0] */
+    long encodedBase;           /* encoded position of input[0] */
+} stream_decoder_t;
+
+/* what ProbeLZSSBuffer found walking the codes of a buffer */
+typedef struct probe_t
+{
+    long size;          /* bytes the buffer decodes to */
+    long paddingIn;     /* input byte the padding at the end starts at */
+    long paddingOut;    /* decoded bytes before the padding */
+} probe_t;
+
+/* output collected in a buffer and written with write(2) in large blocks */
+typedef struct output_sink_t
+{
+    int fd;                 /* file descriptor written to */
+    unsigned char *buffer;  /* bytes not written yet */
+    long size;              /* bytes in buffer */
+    long capacity;          /* bytes buffer can hold */
+    int failed;             /* TRUE once a write has failed */
+    int mapped;             /* TRUE if buffer is the file mapped to */
+                            /* capacity bytes, see MapOutputSink */
+} output_sink_t;
+
+/* input held in memory, mapped straight from the file where it can be */
+typedef struct input_file_t
+{
+    unsigned char *data;    /* bytes of the input, read only if mapped */
+    long size;              /* bytes in data */
+    void *map;              /* mapping data is in, or NULL if allocated */
+    size_t mapSize;         /* bytes mapped */
+} input_file_t;
+
+#ifdef _WIN32
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+#else
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+#endif
+
+/* work done by a thread pool, called once for each task number by the */
+/* worker numbered 0 to threads - 1 that picked it up */
+typedef void (*pool_task_t)(void *context, long task, int worker);
+
+typedef struct thread_pool_t
+{
+    pool_task_t run;    /* function performing a task */
+    void *context;      /* passed to every task */
+    long taskCount;     /* number of tasks */
+    long nextTask;      /* next task to hand out */
+    mutex_t lock;       /* protects nextTask */
+} thread_pool_t;
+
+typedef struct pool_worker_t
+{
+    thread_pool_t *pool;    /* pool the worker takes tasks from */
+    int worker;             /* number passed to each task */
+} pool_worker_t;
+
+/* layout of the 8 tokens following a flag byte */
+typedef struct flag_group_t
+{
+    unsigned char size;         /* bytes of codes following the flag byte */
+    unsigned char matches;      /* number of offset/length codes */
+    unsigned char literals[9];  /* literals before each code and after the */
+                                /* last one */
+    unsigned long long lengthMasks[3];  /* 0xFC under the length of each */
+                                        /* code in the 24 bytes after the */
+                                        /* flag byte */
+} flag_group_t;
+
+/* one chunk of the input decoded in parallel */
+typedef struct decode_chunk_t
+{
+    long inPos;         /* flag byte of the first group */
+    long inEnd;         /* flag byte of the next chunk */
+    long outPos;        /* decoded position of the first group */
+    long outEnd;        /* decoded position of the next chunk */
+    unsigned short *symbols;    /* first bytes decoded, 256 + i standing */
+                                /* for byte i of the chunk's window */
+    long symbolCount;           /* bytes in symbols */
+    int failed;         /* TRUE if symbols couldn't be allocated */
+} decode_chunk_t;
+
+/* encoded buffer split into chunks for DecodeLZSSParallel */
+typedef struct decode_table_t
+{
+    const unsigned char *src;   /* encoded data */
+    long srcLen;                /* bytes of encoded data */
+    unsigned char *dst;         /* decoded data */
+    long dstCap;                /* most bytes the data can decode to */
+    long chunkCount;            /* number of chunks */
+    decode_chunk_t *chunks;     /* chunks in input order */
+    unsigned char *windows;     /* WINDOW_SIZE bytes before each chunk */
+} decode_table_t;
+
+/* one segment of the input, parsed speculatively from its first byte */
+typedef struct parse_segment_t
+{
+    long specEnd;       /* position following the speculative parse */
+    long specTokens;    /* tokens in the speculative parse */
+    long specBytes;     /* bytes they encode to, not counting flags */
+    long parseStart;    /* first token of the real parse in the segment */
+    long tokenBase;     /* real tokens before parseStart */
+    long byteBase;      /* bytes they encode to, not counting flags */
+    int failed;         /* TRUE if verifying a match failed */
+} parse_segment_t;
+
+/* input split between threads that parse and pack a segment each */
+typedef struct match_table_t
+{
+    const unsigned char *data;  /* input being encoded */
+    long size;                  /* number of bytes in data */
+    const match_finder_t *shared;   /* finder each worker's copies */
+    int threads;                /* threads in the pool */
+    int verify;                 /* compare packed matches with brute force */
+    long chunkSize;             /* bytes of input per segment */
+    long segmentCount;          /* number of segments */
+    parse_segment_t *segments;  /* parse of each segment */
+    unsigned short *matches;    /* packed match at each position */
+    match_finder_t *finders;    /* match finder for each worker */
+    int *ready;                 /* TRUE once a worker's finder is set up */
+    long tokens;                /* tokens in the real parse */
+    long fullTokens;            /* tokens in complete groups of 8 */
+    long resumePos;             /* position of the first token not packed */
+    unsigned char *output;      /* encoded groups */
+    int ownsOutput;             /* TRUE if output is freed with the table */
+    long outputSize;            /* bytes of output used */
+} match_table_t;
+
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
@@ -82,18 +411,240 @@ typedef enum
 #define MAX_CODED       (61 + MAX_UNCODED + 1)
 #define MAX_LENGTH      63     /* eb_ecl.exe max for dict 512-1023 */
 
+/* hash chains over 3 byte strings, the shortest encodable match */
+#define HASH_BITS       16
+#define HASH_SIZE       (1 << HASH_BITS)
+#define CHAIN_SIZE      1024   /* power of 2 covering every window offset */
+#define HASH3(p)        ((((unsigned long)(p)[0] << 16) | \
+                         ((unsigned long)(p)[1] << 8) | (p)[2]) * \
+                         2654435761UL >> (32 - HASH_BITS) & (HASH_SIZE - 1))
+
+/* counts of 3 byte strings in the window, hashed so each finder's table */
+/* is 512 KB.  A zero count still means the string isn't in the window. */
+#define GRAM_BITS       18
+#define GRAM_SIZE       (1L << GRAM_BITS)
+#define GRAM3(p)        ((((unsigned long)(p)[0] << 16) | \
+                         ((unsigned long)(p)[1] << 8) | (p)[2]) * \
+                         2654435761UL >> (32 - GRAM_BITS) & (GRAM_SIZE - 1))
+
+/* bit vectors over window positions for the shift-and engine */
+#define BITS_RING       2048   /* power of 2 >= window plus lookahead */
+#define BITS_WORDS      (BITS_RING / 64)
+#define ALIVE_WORDS     ((WINDOW_SIZE + 1) / 64)
+
+/* match table entries: (length << 10) | offset, fits 16 bits exactly */
+#define NO_ENTRY        0x0000 /* position wasn't searched */
+#define LITERAL_ENTRY   0x0001 /* offset without a length, no match found */
+#define PACK_MATCH(m)   ((m).length == 0 ? LITERAL_ENTRY : \
+                         (unsigned short)(((m).length << 10) | (m).offset))
+#define ENTRY_LENGTH(e) ((e) == LITERAL_ENTRY ? 1 : (e) >> 10)
+#define ENTRY_BYTES(e)  ((e) == LITERAL_ENTRY ? 1 : 2)
+#define TABLE_CHUNK     (64L * 1024)
+
+/* how far ahead to check for the end of a run or repeating region */
+#define LOOKAHEAD_BLOCK 4096
+
+/* a string copied COPY_WIDTH bytes at a time writes up to COPY_WIDTH - 1 */
+/* bytes past its end */
+#define COPY_WIDTH      16
+
+/* a flag byte group is decoded without checks when there is room for its */
+/* largest output and wide copies past it, and 8 byte literal copies never */
+/* read past the input */
+#define GROUP_OUTPUT    (8 * MAX_LENGTH + COPY_WIDTH)
+#define GROUP_INPUT     (16 + 8)
+
+/* decoded bytes a match can read from, WINDOW_SIZE back from its start */
+#define HISTORY_SIZE    (WINDOW_SIZE + MAX_LENGTH)
+
+/* bytes a stream decoder decodes ahead of draining, history included */
+#define STREAM_WINDOW   (HISTORY_SIZE + 16L * 1024)
+
+/* bytes an output sink collects before writing them */
+#define SINK_BLOCK      (256L * 1024)
+
+/* most bytes the -e codes of the last group, the -e padding blocks and */
+/* the alignment add to n + n / 8 output bytes, plus the 16 byte copy of */
+/* a group by SinkWriteGroup */
+#define ENCODE_PADDING  (14 + 30 + 15 + 16)
+
+/* bytes read and written at a time by DecodeLZSSStreaming */
+#define STREAM_BLOCK    (64L * 1024)
+
+/* bytes of input EncodeLZSS holds when encoding a pipe */
+#define ENCODE_BLOCK    (1024L * 1024)
+
+/* bytes of input and output together in a chunk decoded in parallel */
+#define DECODE_CHUNK    (256L * 1024)
+
+/* fewest threads, each with a chunk, that decode faster than one thread */
+/* alone, from the time of each pass measured on one core */
+#define DECODE_MIN_THREADS  8
+
+/* decoded bytes between checkpoints written by --index */
+#define CHECKPOINT_INTERVAL (64L * 1024)
+
+/* first 8 bytes of a checkpoint index file */
+#define INDEX_MAGIC     "LZSSIDX1"
+
+/* digests decode_options_t.digests can ask for */
+#define DIGEST_CRC32    0x01
+#define DIGEST_SHA256   0x02
+
 /***************************************************************************
 *                            GLOBAL VARIABLES
 ***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-unsigned char slidingWindow[WINDOW_SIZE];
-unsigned char uncodedLookahead[MAX_CODED];
+/* fastest kernels supported by this CPU, see SelectKernels */
+candidate_mask_t CandidateMask;
+match_length_t MatchLength;
+sha256_blocks_t Sha256Blocks;
+
+/* token layout for each flag byte, see BuildFlagGroups */
+flag_group_t FlagGroups[256];
+
+/* CRC-32 of each byte value followed by 0 to 7 zero bytes, see BuildCrcTable */
+uint32_t CrcTable[8][256];
 
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
-void EncodeLZSS(FILE *inFile, FILE *outFile, int dontPad, int exactPad);   /* encoding routine */
-void DecodeLZSS(FILE *inFile, FILE *outFile);   /* decoding routine */
+encoded_string_t BruteForceMatch(const unsigned char *data, long pos,
+    long size, int firstOffset,
+    encoded_string_t matchData);                /* reference match search */
+int InitMatchFinder(match_finder_t *finder, ENGINES engine,
+    const unsigned char *data, long size, const match_finder_t *shared);
+void FreeMatchFinder(match_finder_t *finder);
+void SlideMatchFinder(match_finder_t *finder, long shift);
+encoded_string_t HashChainMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData);
+int GramInWindow(match_finder_t *finder, long pos);
+void SelectKernels(void);
+int HighestBit(unsigned long long value);
+int LowestBit(unsigned long long value);
+unsigned long CandidateMaskScalar(const unsigned char *block,
+    const unsigned char *current);
+int CheckCandidate(const unsigned char *current, int searchOffset,
+    long remaining, encoded_string_t *matchData);
+int MatchLengthScalar(const unsigned char *a, const unsigned char *b,
+    int maxLen);
+int MatchLengthWord(const unsigned char *a, const unsigned char *b,
+    int maxLen);
+encoded_string_t SimdMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData);
+encoded_string_t ShiftAndMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData);
+int BuildSuffixIndex(suffix_index_t *index, const unsigned char *data,
+    long size);
+void FreeSuffixIndex(suffix_index_t *index);
+int LcpRangeMin(const suffix_index_t *index, long first, long last,
+    int limit, int floor);
+void SetWindowRank(match_finder_t *finder, long pos, int set);
+long NextWindowRank(const match_finder_t *finder, long rank, int floor);
+long PrevWindowRank(const match_finder_t *finder, long rank, int floor);
+encoded_string_t SuffixMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData);
+int RunMatch(match_finder_t *finder, long pos, encoded_string_t *matchData);
+void FindPeriod(match_finder_t *finder, long pos);
+int PeriodMatch(match_finder_t *finder, long pos,
+    encoded_string_t *matchData);
+encoded_string_t FindMatch(match_finder_t *finder, long pos);
+void RunThreadPool(int threads, long taskCount, pool_task_t run,
+    void *context);
+int VerifyMatch(const unsigned char *data, long size, long pos,
+    encoded_string_t match);
+int InitMatchTable(match_table_t *table, const match_finder_t *finder,
+    const encode_options_t *options, unsigned char *output);
+void FreeMatchTable(match_table_t *table);
+void SpeculateTask(void *context, long task, int worker);
+void StitchSegments(match_table_t *table, match_finder_t *finder);
+void PackTask(void *context, long task, int worker);
+int EncodeSegments(match_table_t *table, match_finder_t *finder,
+    output_sink_t *sink);
+int EncodeLZSS(FILE *inFile, FILE *outFile,
+    const encode_options_t *options);           /* encoding routine */
+int AddBatchFile(batch_t *batch, const char *inName, const char *outName);
+int ReadBatchManifest(batch_t *batch, const char *manifestName);
+void FreeBatch(batch_t *batch);
+int CompareBatchFiles(const void *a, const void *b);
+void BatchTask(void *context, long task, int worker);
+int EncodeBatch(batch_t *batch, int threads);
+int DecodeLZSS(FILE *inFile, FILE *outFile,
+    const decode_options_t *options);   /* decoding routine */
+int DecodeLZSSStreaming(FILE *inFile, FILE *outFile, digest_t *digest,
+    checkpoint_index_t *index);
+void DrainStreamToSink(stream_decoder_t *decoder, output_sink_t *sink);
+int DecodeLZSSRange(FILE *inFile, FILE *outFile,
+    const decode_options_t *options, digest_t *digest);
+unsigned char *ReadInputFile(FILE *inFile, long *size);
+int MapInputFile(input_file_t *input, FILE *inFile);
+int LoadInputFile(input_file_t *input, FILE *inFile);
+void FreeInputFile(input_file_t *input);
+long DecodeLZSSPartial(const unsigned char *src, long srcLen,
+    unsigned char *dst, long dstCap, decode_end_t *end);
+long DecodeLZSSFrom(const unsigned char *src, long srcLen,
+    unsigned char *dst, long dstCap, long inPos, long outPos,
+    decode_end_t *end);
+void DecodeGroup(const unsigned char *src, unsigned char *dst, long *inPos,
+    long *outPos);
+long PaddingEnd(const unsigned char *src, long srcLen,
+    const decode_end_t *end);
+int ProbeLZSS(FILE *inFile, FILE *outFile);
+long ProbeLZSSBuffer(const unsigned char *src, long srcLen, probe_t *probe);
+long GroupOutput(const unsigned char *src);
+int SplitDecodeChunks(decode_table_t *table);
+unsigned short CopySymbols(unsigned short *symbols, long out, int offset,
+    int length);
+void ExpandSymbols(decode_table_t *table, decode_chunk_t *chunk,
+    long *inPos, long *outPos);
+void ExpandTask(void *context, long task, int worker);
+unsigned char DecodedByte(const decode_table_t *table, long chunk, long pos);
+void ResolveTask(void *context, long task, int worker);
+unsigned char *DecodeLZSSParallel(const unsigned char *src, long srcLen,
+    int threads, long *size);
+int InitStreamDecoder(stream_decoder_t *decoder);
+void FreeStreamDecoder(stream_decoder_t *decoder);
+void FeedStreamDecoder(stream_decoder_t *decoder, const unsigned char *data,
+    long size);
+void StreamDecodeTokens(stream_decoder_t *decoder);
+long DrainStreamDecoder(stream_decoder_t *decoder, unsigned char *out,
+    long cap);
+void BuildFlagGroups(void);
+void InitDigest(digest_t *digest, int digests);
+void UpdateDigest(digest_t *digest, const unsigned char *data, long size);
+unsigned long FinishDigest(digest_t *digest, unsigned char *sha256);
+void ReportDigest(digest_t *digest, FILE *outFile);
+void BuildCrcTable(void);
+uint32_t UpdateCrc32(uint32_t crc, const unsigned char *data, long size);
+void Sha256BlocksScalar(uint32_t *state, const unsigned char *data,
+    long blocks);
+#ifdef HAVE_X86_SIMD
+void Sha256BlocksSHA(uint32_t *state, const unsigned char *data,
+    long blocks);
+#endif
+void InitCheckpointIndex(checkpoint_index_t *index, long interval);
+void FreeCheckpointIndex(checkpoint_index_t *index);
+void AddCheckpoint(checkpoint_index_t *index, const unsigned char *decoded,
+    long decodedPos, long encodedPos);
+void IndexGroups(checkpoint_index_t *index, const unsigned char *src,
+    long srcLen, const unsigned char *decoded, long decodedLen);
+long FindCheckpoint(const checkpoint_index_t *index, long decodedPos);
+void SeekStreamDecoder(stream_decoder_t *decoder,
+    const checkpoint_index_t *index, long checkpoint);
+int WriteCheckpointIndex(const checkpoint_index_t *index, FILE *outFile);
+int ReadCheckpointIndex(checkpoint_index_t *index, FILE *inFile);
+void WriteIndexValue(FILE *outFile, long value);
+int ReadIndexValue(FILE *inFile, long *value);
+int InitOutputSink(output_sink_t *sink, FILE *outFile);
+int MapOutputSink(output_sink_t *sink, long bound);
+int FreeOutputSink(output_sink_t *sink);
+int FlushOutputSink(output_sink_t *sink);
+void WriteSinkData(output_sink_t *sink, const unsigned char *data,
+    long size);
+void SinkWrite(output_sink_t *sink, const unsigned char *data, long size);
+void SinkWriteGroup(output_sink_t *sink, unsigned char flags,
+    const unsigned char *codes, int size);
+void CopyMatch(unsigned char *dst, long outPos, int offset, int length);
+void CopyMatchWide(unsigned char *dst, long outPos, int offset, int length);
 
 /***************************************************************************
 *                                FUNCTIONS
@@ -113,20 +664,55 @@ void DecodeLZSS(FILE *inFile, FILE *outFile);   /* decoding routine */
 int main(int argc, char *argv[])
 {
     int opt;
-    int dontPad;
-    int exactPad;
+    int status;
+    encode_options_t options;
+    decode_options_t decodeOptions;
     FILE *inFile, *outFile;  /* input & output files */
+    FILE *indexFile;
     MODES mode;
+    char *end;
+    const char *indexName;
+    checkpoint_index_t index;
+    int batchMode;
+    const char *manifestName;
+    batch_t batch;
+    static const struct option longOptions[] =
+    {
+        {"size", required_argument, NULL, OPT_SIZE},
+        {"probe", no_argument, NULL, OPT_PROBE},
+        {"crc32", no_argument, NULL, OPT_CRC32},
+        {"sha256", no_argument, NULL, OPT_SHA256},
+        {"index", required_argument, NULL, OPT_INDEX},
+        {"range", required_argument, NULL, OPT_RANGE},
+        {"batch", no_argument, NULL, OPT_BATCH},
+        {"manifest", required_argument, NULL, OPT_MANIFEST},
+        {NULL, 0, NULL, 0}
+    };
 
     /* initialize data */
     inFile = NULL;
     outFile = NULL;
     mode = ENCODE;
-    dontPad = 0;
-    exactPad = 0;
+    options.dontPad = 0;
+    options.exactPad = 0;
+    options.engine = ENGINE_CHAIN;
+    options.verify = 0;
+    options.threads = 1;
+    options.index = NULL;
+    options.name = NULL;
+    indexName = NULL;
+    batchMode = FALSE;
+    manifestName = NULL;
+    decodeOptions.size = -1;
+    decodeOptions.threads = 1;
+    decodeOptions.digests = 0;
+    decodeOptions.index = NULL;
+    decodeOptions.rangeStart = 0;
+    decodeOptions.rangeLength = -1;
 
     /* parse command line */
-    while ((opt = getopt(argc, argv, "cdetnpsi:o:h?")) != -1)
+    while ((opt = getopt_long(argc, argv, "cdetnpsvi:o:m:j:h?", longOptions,
+        NULL)) != -1)
     {
         switch(opt)
         {
@@ -138,7 +724,7 @@ int main(int argc, char *argv[])
                 mode = DECODE;
                 break;
             case 'e':       /* exact length decompression padding */
-                exactPad = 1;
+                options.exactPad = 1;
                 break;
             case 'i':       /* input file name */
                 if (inFile != NULL)
@@ -179,7 +765,7 @@ int main(int argc, char *argv[])
 
                     exit(EXIT_FAILURE);
                 }
-                else if ((outFile = fopen(optarg, "wb")) == NULL)
+                else if ((outFile = fopen(optarg, "w+b")) == NULL)
                 {
                     perror("Opening outFile");
 
@@ -192,7 +778,123 @@ int main(int argc, char *argv[])
                 }
                 break;
             case 'p':
-                dontPad = 1;
+                options.dontPad = 1;
+                break;
+            case 'm':       /* match finding engine */
+                if (strcmp(optarg, "brute") == 0)
+                {
+                    options.engine = ENGINE_BRUTE;
+                }
+                else if (strcmp(optarg, "chain") == 0)
+                {
+                    options.engine = ENGINE_CHAIN;
+                }
+                else if (strcmp(optarg, "simd") == 0)
+                {
+                    options.engine = ENGINE_SIMD;
+                }
+                else if (strcmp(optarg, "shiftand") == 0)
+                {
+                    options.engine = ENGINE_SHIFTAND;
+                }
+                else if (strcmp(optarg, "suffix") == 0)
+                {
+                    options.engine = ENGINE_SUFFIX;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown match engine: %s\n", optarg);
+
+                    if (inFile != NULL)
+                    {
+                        fclose(inFile);
+                    }
+
+                    if (outFile != NULL)
+                    {
+                        fclose(outFile);
+                    }
+
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v':       /* check engine against brute force search */
+                options.verify = 1;
+                break;
+            case 'j':       /* match finding threads */
+                options.threads = atoi(optarg);
+
+                if (options.threads < 1)
+                {
+                    options.threads = 1;
+                }
+                break;
+            case OPT_SIZE:  /* decoded size is known */
+                decodeOptions.size = strtol(optarg, &end, 0);
+
+                if (*end != '\0' || decodeOptions.size < 0)
+                {
+                    fprintf(stderr, "Invalid size: %s\n", optarg);
+
+                    if (inFile != NULL)
+                    {
+                        fclose(inFile);
+                    }
+
+                    if (outFile != NULL)
+                    {
+                        fclose(outFile);
+                    }
+
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_PROBE: /* report the decoded size */
+                mode = PROBE;
+                break;
+            case OPT_CRC32: /* report digests of the decoded data */
+                decodeOptions.digests |= DIGEST_CRC32;
+                break;
+            case OPT_SHA256:
+                decodeOptions.digests |= DIGEST_SHA256;
+                break;
+            case OPT_INDEX: /* checkpoint index to write or seek with */
+                indexName = optarg;
+                break;
+            case OPT_RANGE: /* decode part of the output */
+                decodeOptions.rangeStart = strtol(optarg, &end, 0);
+
+                if (*end == ':')
+                {
+                    decodeOptions.rangeLength = strtol(end + 1, &end, 0);
+                }
+
+                if (*end != '\0' || decodeOptions.rangeStart < 0 ||
+                    decodeOptions.rangeLength < 0)
+                {
+                    fprintf(stderr, "Invalid range: %s\n", optarg);
+
+                    if (inFile != NULL)
+                    {
+                        fclose(inFile);
+                    }
+
+                    if (outFile != NULL)
+                    {
+                        fclose(outFile);
+                    }
+
+                    exit(EXIT_FAILURE);
+                }
+
+                mode = DECODE;
+                break;
+            case OPT_BATCH: /* encode the files named after the options */
+                batchMode = TRUE;
+                break;
+            case OPT_MANIFEST:  /* encode the files listed in a manifest */
+                manifestName = optarg;
+                batchMode = TRUE;
                 break;
             case 's':
 		#ifdef _WIN32
@@ -213,12 +915,84 @@ int main(int argc, char *argv[])
                 printf("  -o <filename> : Name of output file.\n");
                 printf("  -s : Use STDIN/STDOUT.\n");
                 printf("  -p : Do not pad output data to multiples of 0x10.\n");
+                printf("  -m <engine> : Match engine, brute, chain, simd, shiftand or\n");
+                printf("                suffix (default chain).\n");
+                printf("  -v : Verify every match against the brute force search.\n");
+                printf("  -j <threads> : Find matches using this many threads.  Decoding\n");
+                printf("                 uses them from 8 threads and 8 chunks of 256 KB.\n");
+                printf("  --size <bytes> : Decode exactly this many bytes and check that\n");
+                printf("                   the rest of the input is padding.  -e padding\n");
+                printf("                   decodes as 00 00 codes, so it counts as 0 bytes.\n");
+                printf("  --probe : Print the decoded size and where padding starts\n");
+                printf("            without decoding (to stdout without -o).\n");
+                printf("  --crc32, --sha256 : Print digests of the decoded data.\n");
+                printf("  --index <filename> : Write a checkpoint index while encoding or\n");
+                printf("                       decoding, or seek with it for --range.\n");
+                printf("  --range <start>:<bytes> : Decode only these bytes of the output.\n");
+                printf("  --batch : Encode each file named after the options to\n");
+                printf("            <file>.lzss, -j files at a time.\n");
+                printf("  --manifest <filename> : Encode the files listed one per line, each\n");
+                printf("                          optionally followed by a tab and the\n");
+                printf("                          output name, -j files at a time.\n");
                 printf("  -h | ?  : Print out command line options.\n\n");
                 printf("Default: lzss -c\n");
                 return(EXIT_SUCCESS);
         }
     }
 
+    if (batchMode)
+    {
+        /* the batch opens every file itself */
+        if (mode != ENCODE || inFile != NULL || outFile != NULL ||
+            indexName != NULL)
+        {
+            fprintf(stderr, "--batch and --manifest only encode, and take no "
+                "-i, -o, -s or --index\n");
+
+            if (inFile != NULL)
+            {
+                fclose(inFile);
+            }
+
+            if (outFile != NULL)
+            {
+                fclose(outFile);
+            }
+
+            exit(EXIT_FAILURE);
+        }
+
+        batch.files = NULL;
+        batch.count = 0;
+        batch.capacity = 0;
+        batch.manifest = NULL;
+        batch.options = &options;
+        status = TRUE;
+
+        if (manifestName != NULL && !ReadBatchManifest(&batch, manifestName))
+        {
+            fprintf(stderr, "Can't read manifest %s\n", manifestName);
+            status = FALSE;
+        }
+
+        for (; status && optind < argc; optind++)
+        {
+            if (!AddBatchFile(&batch, argv[optind], NULL))
+            {
+                fprintf(stderr, "Memory allocation failed\n");
+                status = FALSE;
+            }
+        }
+
+        if (status)
+        {
+            status = EncodeBatch(&batch, options.threads);
+        }
+
+        FreeBatch(&batch);
+        return status ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     /* validate command line */
     if (inFile == NULL)
     {
@@ -232,6 +1006,10 @@ int main(int argc, char *argv[])
 
         exit (EXIT_FAILURE);
     }
+    else if (outFile == NULL && mode == PROBE)
+    {
+        outFile = stdout;
+    }
     else if (outFile == NULL)
     {
         fprintf(stderr, "Output file must be provided\n");
@@ -245,94 +1023,157 @@ int main(int argc, char *argv[])
         exit (EXIT_FAILURE);
     }
 
+    if (indexName != NULL && mode == DECODE && decodeOptions.rangeLength >= 0)
+    {
+        /* seek with an existing index */
+        InitCheckpointIndex(&index, CHECKPOINT_INTERVAL);
+        indexFile = fopen(indexName, "rb");
+
+        if (indexFile == NULL || !ReadCheckpointIndex(&index, indexFile))
+        {
+            fprintf(stderr, "Can't read index %s\n", indexName);
+
+            if (indexFile != NULL)
+            {
+                fclose(indexFile);
+            }
+
+            fclose(inFile);
+            fclose(outFile);
+            exit(EXIT_FAILURE);
+        }
+
+        fclose(indexFile);
+        decodeOptions.index = &index;
+        indexName = NULL;
+    }
+    else if (indexName != NULL && mode != PROBE)
+    {
+        /* written once the encode or decode is done */
+        InitCheckpointIndex(&index, CHECKPOINT_INTERVAL);
+        options.index = &index;
+        decodeOptions.index = &index;
+    }
+
     /* we have valid parameters encode or decode */
+    status = TRUE;
+
     if (mode == ENCODE)
     {
-        EncodeLZSS(inFile, outFile, dontPad, exactPad);
+        status = EncodeLZSS(inFile, outFile, &options);
+    }
+    else if (mode == DECODE)
+    {
+        decodeOptions.threads = options.threads;
+        status = DecodeLZSS(inFile, outFile, &decodeOptions);
     }
     else
     {
-        DecodeLZSS(inFile, outFile);
+        status = ProbeLZSS(inFile, outFile);
+    }
+
+    if (status && indexName != NULL && mode != PROBE)
+    {
+        indexFile = fopen(indexName, "wb");
+
+        if (indexFile == NULL || !WriteCheckpointIndex(&index, indexFile))
+        {
+            fprintf(stderr, "Can't write index %s\n", indexName);
+            status = FALSE;
+        }
+
+        if (indexFile != NULL)
+        {
+            fclose(indexFile);
+        }
+    }
+
+    if (decodeOptions.index != NULL)
+    {
+        FreeCheckpointIndex(&index);
     }
 
     fclose(inFile);
     fclose(outFile);
-    return EXIT_SUCCESS;
+    return status ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /****************************************************************************
-*   Function   : FindMatch
-*   Description: This function will search through the slidingWindow
-*                dictionary for the longest sequence matching the MAX_CODED
-*                long string stored in uncodedLookahed.
-*   Parameters : windowHead - head of sliding window
-*                uncodedHead - head of uncoded lookahead buffer
+*   Function   : BruteForceMatch
+*   Description: This function searches every offset from firstOffset to
+*                the window size for the eb_ecl.exe match at the given input
+*                position.  Searching from offset 3 with no match so far is
+*                the reference search the other engines must agree with.
+*   Parameters : data - input being encoded
+*                pos - position in data to find a match for
+*                size - number of bytes in data
+*                firstOffset - first offset to search (3 for a full search)
+*                matchData - best match at offsets below firstOffset, a
+*                            length of 2 if there is none
 *   Effects    : NONE
-*   Returned   : The sliding window index where the match starts and the
+*   Returned   : The offset back from pos where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(int windowHead, int uncodedHead, int uncodedTail)
+encoded_string_t BruteForceMatch(const unsigned char *data, long pos,
+    long size, int firstOffset, encoded_string_t matchData)
 {
-    encoded_string_t matchData;
-    int i, j;
-    int search_offset;
-    int max_check;
+    int searchLimit;
+    int searchOffset;
+    long remaining;
 
-    matchData.length = 2;  /* Must beat 2 to be worth encoding (>= 3) */
-    matchData.offset = 0;
+    remaining = size - pos;
 
-    /* Search from offset 3 (minimum match) upward, like eb_ecl.exe */
-    /* windowHead points to next write position, so data is behind it */
-    for (search_offset = 3; search_offset <= WINDOW_SIZE; search_offset++)
+    /* Determine search limit: min(pos, WINDOW_SIZE) */
+    searchLimit = (pos <= WINDOW_SIZE) ? (int)pos : WINDOW_SIZE;
+
+    /* Search for matches from offset 3 upward (eb_ecl.exe style) */
+    for (searchOffset = firstOffset; searchOffset <= searchLimit; searchOffset++)
     {
-        /* Calculate position in circular buffer */
-        int candidate_pos = (windowHead - search_offset + WINDOW_SIZE) % WINDOW_SIZE;
+        const unsigned char *current = data + pos;
+        const unsigned char *candidate = current - searchOffset;
+        int maxCheck;
+        int matchLen;
 
         /* Quick rejection: check first byte */
-        if (slidingWindow[candidate_pos] != uncodedLookahead[uncodedHead % MAX_CODED])
+        if (*current != *candidate)
         {
             continue;
         }
 
-        /* Quick rejection: check byte at current best length position */
-        if (matchData.length < uncodedTail)
+        /* Quick rejection: check byte at best length position */
+        if (matchData.length < remaining &&
+            current[matchData.length] != candidate[matchData.length])
         {
-            int check_pos = (candidate_pos + matchData.length) % WINDOW_SIZE;
-            if (slidingWindow[check_pos] != uncodedLookahead[(uncodedHead + matchData.length) % MAX_CODED])
-            {
-                continue;
-            }
+            continue;
         }
 
-        /* Determine max length to check */
-        max_check = uncodedTail;
-        if (max_check > MAX_CODED - 1)
-            max_check = MAX_CODED - 1;
-        if (max_check > search_offset)
-            max_check = search_offset;  /* Can't match more than offset distance */
+        /* Determine max check length - eb_ecl.exe uses min(remaining, offset) */
+        /* then caps result to max_length later */
+        maxCheck = (remaining < (long)searchOffset) ? (int)remaining : searchOffset;
 
         /* Count matching bytes */
-        for (j = 0; j < max_check; j++)
+        for (matchLen = 0; matchLen < maxCheck; matchLen++)
         {
-            int src_pos = (candidate_pos + j) % WINDOW_SIZE;
-            if (slidingWindow[src_pos] != uncodedLookahead[(uncodedHead + j) % MAX_CODED])
+            if (current[matchLen] != candidate[matchLen])
             {
                 break;
             }
         }
 
-        /* Update best match if this is better (strict >, not >=) */
-        if (j > matchData.length)
+        /* Update best if strictly better */
+        if (matchLen > matchData.length)
         {
-            matchData.length = j;
-            matchData.offset = search_offset;  /* Store as distance back */
+            matchData.length = matchLen;
+            matchData.offset = searchOffset;
+        }
 
-            /* Early termination if we hit max length */
-            if (j >= MAX_CODED - 1)
-            {
-                break;
-            }
+        /* eb_ecl.exe: when match exceeds max_length, cap and exit */
+        if (matchLen > MAX_LENGTH)
+        {
+            matchData.length = MAX_LENGTH;
+            matchData.offset = searchOffset;
+            break;
         }
     }
 
@@ -347,337 +1188,6011 @@ encoded_string_t FindMatch(int windowHead, int uncodedHead, int uncodedTail)
 }
 
 /****************************************************************************
-*   Function   : EncodeLZSS
-*   Description: This function will read an input file and write an output
-*                file encoded using the eb_ecl.exe LZSS variant.
-*                Rewritten to match eb_ecl.exe algorithm exactly:
-*                - Reads entire file into memory
-*                - Searches directly in input buffer (no ring buffer)
-*                - Search from offset 3 upward
-*   Parameters : inFile - file to encode
-*                outFile - file to write encoded output
-*   Effects    : inFile is encoded and written to outFile
-*   Returned   : NONE
+*   Function   : InitMatchFinder
+*   Description: This function prepares a match finder for searching an
+*                input that is held entirely in memory.
+*   Parameters : finder - match finder to initialize
+*                engine - method used to find candidates
+*                data - input being encoded
+*                size - number of bytes in data
+*                shared - finder for the same input and engine whose read
+*                         only tables may be used instead of building new
+*                         ones, or NULL
+*   Effects    : Memory for the engine's tables is allocated
+*   Returned   : TRUE for success, otherwise FALSE.
 ****************************************************************************/
-void EncodeLZSS(FILE *inFile, FILE *outFile, int dontPad, int exactPad)
+int InitMatchFinder(match_finder_t *finder, ENGINES engine,
+    const unsigned char *data, long size, const match_finder_t *shared)
 {
-    unsigned char *inputData;
-    unsigned char flags, flagPos, encodedData[16];
-    int nextEncoded;
-    long inputSize, inputPos;
-    long remaining;
-    long compressedSize;
     int i;
 
-    /* Read entire file into memory (like eb_ecl.exe) */
-    fseek(inFile, 0, SEEK_END);
-    inputSize = ftell(inFile);
-    fseek(inFile, 0, SEEK_SET);
+    finder->engine = engine;
+    finder->data = data;
+    finder->size = size;
+    finder->nextInsert = 0;
+    finder->hashHead = NULL;
+    finder->hashPrev = NULL;
+    finder->byteBits = NULL;
+    finder->bitsLow = 0;
+    finder->bitsHigh = 0;
+    finder->gramCount = NULL;
+    finder->gramLow = 0;
+    finder->gramHigh = 0;
+    finder->runStart = 0;
+    finder->runEnd = 0;
+    finder->runClosed = TRUE;
+    finder->period = 0;
+    finder->periodStart = 0;
+    finder->periodEnd = 0;
+    finder->periodClosed = TRUE;
+    finder->periodCheck = -1;
+    finder->periodOffset = 0;
+    finder->suffixIndex = NULL;
+    finder->ownsIndex = FALSE;
+    finder->windowRanks = NULL;
+    finder->windowWords = NULL;
+    finder->windowLow = 0;
+    finder->windowHigh = 0;
 
-    if (inputSize <= 0)
-    {
-        return;
-    }
+    SelectKernels();
 
-    inputData = (unsigned char *)malloc(inputSize);
-    if (inputData == NULL)
+    if (engine == ENGINE_BRUTE || engine == ENGINE_SIMD)
     {
-        fprintf(stderr, "Memory allocation failed\n");
-        return;
-    }
+        /* mostly untouched, so let the allocator hand back zeroed pages */
+        finder->gramCount =
+            (unsigned short *)calloc(GRAM_SIZE, sizeof(unsigned short));
 
-    if (fread(inputData, 1, inputSize, inFile) != (size_t)inputSize)
+        if (finder->gramCount == NULL)
+        {
+            return FALSE;
+        }
+    }
+    else if (engine == ENGINE_CHAIN)
     {
-        free(inputData);
-        return;
+        finder->hashHead = (long *)malloc(HASH_SIZE * sizeof(long));
+        finder->hashPrev = (long *)malloc(CHAIN_SIZE * sizeof(long));
+
+        if (finder->hashHead == NULL || finder->hashPrev == NULL)
+        {
+            FreeMatchFinder(finder);
+            return FALSE;
+        }
+
+        for (i = 0; i < HASH_SIZE; i++)
+        {
+            finder->hashHead[i] = -1;
+        }
     }
+    else if (engine == ENGINE_SHIFTAND)
+    {
+        finder->byteBits = (unsigned long long *)calloc(256 * BITS_WORDS,
+            sizeof(unsigned long long));
 
-    flags = 0;
-    flagPos = 0x80;
-    nextEncoded = 0;
-    inputPos = 0;
-    compressedSize = 0;
-
-    /* Process input like eb_ecl.exe does */
-    while (inputPos < inputSize)
+        if (finder->byteBits == NULL)
+        {
+            return FALSE;
+        }
+    }
+    else if (engine == ENGINE_SUFFIX)
     {
-        int searchLimit;
-        int bestLength = 2;  /* Must beat 2 (find >= 3) */
-        int bestOffset = 0;
-        int searchOffset;
+        if (shared != NULL && shared->suffixIndex != NULL)
+        {
+            /* the index only depends on the input */
+            finder->suffixIndex = shared->suffixIndex;
+        }
+        else
+        {
+            finder->suffixIndex =
+                (suffix_index_t *)malloc(sizeof(suffix_index_t));
+
+            if (finder->suffixIndex == NULL)
+            {
+                return FALSE;
+            }
+
+            if (!BuildSuffixIndex(finder->suffixIndex, data, size))
+            {
+                free(finder->suffixIndex);
+                finder->suffixIndex = NULL;
+                return FALSE;
+            }
 
-        remaining = inputSize - inputPos;
+            finder->ownsIndex = TRUE;
+        }
 
-        /* Determine search limit: min(inputPos, WINDOW_SIZE) */
-        searchLimit = (inputPos <= WINDOW_SIZE) ? (int)inputPos : WINDOW_SIZE;
+        finder->windowRanks = (unsigned long long *)calloc(size / 64 + 1,
+            sizeof(unsigned long long));
+        finder->windowWords = (unsigned long long *)calloc(size / 4096 + 1,
+            sizeof(unsigned long long));
 
-        /* Search for matches from offset 3 upward (eb_ecl.exe style) */
-        if (searchLimit >= 3)
+        if (finder->windowRanks == NULL || finder->windowWords == NULL)
         {
-            for (searchOffset = 3; searchOffset <= searchLimit; searchOffset++)
-            {
-                unsigned char *current = inputData + inputPos;
-                unsigned char *candidate = current - searchOffset;
-                int maxCheck;
-                int matchLen;
+            FreeMatchFinder(finder);
+            return FALSE;
+        }
+    }
 
-                /* Quick rejection: check first byte */
-                if (*current != *candidate)
-                {
-                    continue;
-                }
+    return TRUE;
+}
 
-                /* Quick rejection: check byte at best length position */
-                if (bestLength < remaining && current[bestLength] != candidate[bestLength])
-                {
-                    continue;
-                }
+/****************************************************************************
+*   Function   : FreeMatchFinder
+*   Description: This function releases the tables held by a match finder.
+*   Parameters : finder - match finder to free
+*   Effects    : Memory for the engine's tables is freed
+*   Returned   : NONE
+****************************************************************************/
+void FreeMatchFinder(match_finder_t *finder)
+{
+    free(finder->hashHead);
+    free(finder->hashPrev);
+    free(finder->gramCount);
+    free(finder->byteBits);
+    free(finder->windowRanks);
+    free(finder->windowWords);
+    finder->hashHead = NULL;
+    finder->hashPrev = NULL;
+    finder->gramCount = NULL;
+    finder->byteBits = NULL;
+    finder->windowRanks = NULL;
+    finder->windowWords = NULL;
 
-                /* Determine max check length - eb_ecl.exe uses min(remaining, offset) */
-                /* then caps result to max_length later */
-                maxCheck = (remaining < (long)searchOffset) ? (int)remaining : searchOffset;
+    if (finder->ownsIndex)
+    {
+        FreeSuffixIndex(finder->suffixIndex);
+        free(finder->suffixIndex);
+        finder->ownsIndex = FALSE;
+    }
 
-                /* Count matching bytes */
-                for (matchLen = 0; matchLen < maxCheck; matchLen++)
-                {
-                    if (current[matchLen] != candidate[matchLen])
-                    {
-                        break;
-                    }
-                }
+    finder->suffixIndex = NULL;
+}
 
-                /* Update best if strictly better */
-                if (matchLen > bestLength)
-                {
-                    bestLength = matchLen;
-                    bestOffset = searchOffset;
-                }
+/****************************************************************************
+*   Function   : SlideMatchFinder
+*   Description: This function renumbers the positions a match finder
+*                holds so that the input can be moved down by shift bytes,
+*                as the stream encoder does when it reads more input.
+*                State for positions before shift is dropped while they
+*                can still be read.  shift must be a multiple of BITS_RING
+*                so the chains and byte bits keep their slots, and the
+*                bytes from WINDOW_SIZE + 32 before the next position
+*                searched must be kept.  A run or repeating region reaching
+*                the end of the data read so far is reopened, as it may
+*                carry on into the input still to come.  The suffix engine
+*                needs the whole input and can't be slid.
+*   Parameters : finder - match finder state
+*                shift - bytes the input is about to move down by
+*   Effects    : Positions before shift are dropped from the finder and
+*                the rest are shift lower
+*   Returned   : NONE
+****************************************************************************/
+void SlideMatchFinder(match_finder_t *finder, long shift)
+{
+    const unsigned char *data;
+    long i, end;
 
-                /* eb_ecl.exe: when match exceeds max_length, cap and exit */
-                if (matchLen > MAX_LENGTH)
-                {
-                    bestLength = MAX_LENGTH;
-                    bestOffset = searchOffset;
-                    break;
-                }
-            }
-        }
+    data = finder->data;
 
-        /* Cap length to MAX_LENGTH (63 for dict 1023) */
-        if (bestLength > MAX_LENGTH)
+    if (finder->hashHead != NULL)
+    {
+        for (i = 0; i < HASH_SIZE; i++)
         {
-            bestLength = MAX_LENGTH;
+            finder->hashHead[i] = (finder->hashHead[i] >= shift) ?
+                finder->hashHead[i] - shift : -1;
         }
 
-        /* Encode the result */
-        if (bestLength >= 3 && bestOffset >= 3)
-        {
-            /* Match: encode as (length, offset) pair */
-            /* eb_ecl.exe format: byte1 = (length << 2) | (offset >> 8) */
-            /*                    byte2 = offset & 0xFF                 */
-            encodedData[nextEncoded++] = (unsigned char)((bestOffset >> 8) | (bestLength << 2));
-            encodedData[nextEncoded++] = (unsigned char)(bestOffset & 0xFF);
-            flags |= flagPos;
-            inputPos += bestLength;
-        }
-        else
+        for (i = 0; i < CHAIN_SIZE; i++)
         {
-            /* Literal byte */
-            encodedData[nextEncoded++] = inputData[inputPos];
-            inputPos++;
+            finder->hashPrev[i] = (finder->hashPrev[i] >= shift) ?
+                finder->hashPrev[i] - shift : -1;
         }
+    }
 
-        if (flagPos == 0x01)
-        {
-            /* Write flags and encoded data */
-            putc(flags, outFile);
-            compressedSize++;
+    finder->nextInsert = (finder->nextInsert > shift) ?
+        finder->nextInsert - shift : 0;
 
-            for (i = 0; i < nextEncoded; i++)
-            {
-                putc(encodedData[i], outFile);
-                compressedSize++;
-            }
+    if (finder->gramCount != NULL)
+    {
+        end = (finder->gramHigh < shift) ? finder->gramHigh : shift;
 
-            flags = 0;
-            flagPos = 0x80;
-            nextEncoded = 0;
-        }
-        else
+        for (i = finder->gramLow; i < end; i++)
         {
-            flagPos >>= 1;
+            finder->gramCount[GRAM3(data + i)]--;
         }
     }
 
-    /* write out any remaining encoded data */
-    if (nextEncoded != 0)
+    finder->gramLow = (finder->gramLow > shift) ? finder->gramLow - shift : 0;
+    finder->gramHigh = (finder->gramHigh > shift) ?
+        finder->gramHigh - shift : 0;
+
+    if (finder->byteBits != NULL)
     {
-        int totalSize = (compressedSize + nextEncoded + 1);
-        int remainder = 16 - (totalSize % 16);
-        /*
-        in exact mode, we need to treat padding bytes as a compression command
-        otherwise they will pollute the output length for decompressors which are not length restricted
-        */
-        if (exactPad && (totalSize % 16 != 0)) {
-            while ((compressedSize + nextEncoded + 1) % 16 != 0) {
-                if(flagPos == 0x00) {
-                    break;
-                }
-                remainder -= 2;
-                encodedData[nextEncoded++] = 0;
-                encodedData[nextEncoded++] = 0;
-                flags |= flagPos;
-                flagPos >>= 1;
-            }
-        }
-        putc(flags, outFile);
-	    compressedSize++;
-        for (i = 0; i < nextEncoded; i++)
+        end = (finder->bitsHigh < shift) ? finder->bitsHigh : shift;
+
+        for (i = finder->bitsLow; i < end; i++)
         {
-            putc(encodedData[i], outFile);
-	        compressedSize++;
+            finder->byteBits[data[i] * BITS_WORDS +
+                ((i >> 6) & (BITS_WORDS - 1))] &= ~(1ULL << (i & 63));
         }
     }
-    /* 
-    We exhausted our input data, and might still have leftover bytes to fill 
-    we need to write out padding blocks that resolve to a no-op.
-    */
-    if (exactPad) {
-        int remainder = 16 - (compressedSize % 16);
-        int padding_lengths[17] = {0x0, 0x1, 0x12, 0x3, 0x14, 0x5, 0x16, 0x7, 0x18, 0x9, 0x1A, 0xB, 0x1C, 0xD, 0x1E, 0xF, 0x0};
-        char padding_block[17] = {0xFF, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
-        remainder = padding_lengths[remainder];
-        for(i = 0; i < remainder; i++) {
-            putc(padding_block[i % 0x11], outFile);
-            compressedSize++;
-        }
+
+    finder->bitsLow = (finder->bitsLow > shift) ? finder->bitsLow - shift : 0;
+    finder->bitsHigh = (finder->bitsHigh > shift) ?
+        finder->bitsHigh - shift : 0;
+
+    if (finder->runEnd == finder->size)
+    {
+        finder->runClosed = FALSE;
     }
-    if (dontPad == 0)
+
+    if (finder->periodEnd == finder->size)
+    {
+        finder->periodClosed = FALSE;
+    }
+
+    finder->runStart = (finder->runStart > shift) ?
+        finder->runStart - shift : 0;
+    finder->runEnd = (finder->runEnd > shift) ? finder->runEnd - shift : 0;
+    finder->periodStart = (finder->periodStart > shift) ?
+        finder->periodStart - shift : 0;
+    finder->periodEnd = (finder->periodEnd > shift) ?
+        finder->periodEnd - shift : 0;
+    finder->periodCheck = (finder->periodCheck >= shift) ?
+        finder->periodCheck - shift : -1;
+    finder->size -= shift;
+}
+
+/****************************************************************************
+*   Function   : GramInWindow
+*   Description: This function slides the 3 byte string counts so they
+*                cover the strings starting at offsets 3 to WINDOW_SIZE
+*                back from pos, then checks whether the string at pos is
+*                one of them.  If it isn't, no offset can match 3 or more
+*                bytes and the position must be encoded as a literal.
+*                Strings sharing a hash share a count, so a string may be
+*                reported that isn't there, and the search finds nothing.
+*   Parameters : finder - match finder state
+*                pos - position in the input to be encoded
+*   Effects    : gramCount is moved to the window for pos
+*   Returned   : TRUE if the 3 bytes at pos may occur in the window,
+*                FALSE if they don't.
+****************************************************************************/
+int GramInWindow(match_finder_t *finder, long pos)
+{
+    const unsigned char *data;
+    long low;
+    long i;
+
+    data = finder->data;
+    low = (pos > WINDOW_SIZE) ? pos - WINDOW_SIZE : 0;
+
+    if ((finder->gramHigh > pos - 2 && finder->gramHigh > finder->gramLow) ||
+        low >= finder->gramHigh)
     {
-        while ((compressedSize % 0x10) != 0)
+        /* nothing counted is still in the window, so start over */
+        for (i = finder->gramLow; i < finder->gramHigh; i++)
         {
-            putc(0x00, outFile);
-            compressedSize++;
+            finder->gramCount[GRAM3(data + i)]--;
         }
+
+        finder->gramLow = low;
+        finder->gramHigh = low;
+    }
+
+    for (i = finder->gramHigh; i <= pos - 3; i++)
+    {
+        finder->gramCount[GRAM3(data + i)]++;
     }
-    fprintf(stderr, "compressedSize %lx\n", compressedSize);
-    free(inputData);
+
+    if (i > finder->gramHigh)
+    {
+        finder->gramHigh = i;
+    }
+
+    for (i = finder->gramLow; i < low; i++)
+    {
+        finder->gramCount[GRAM3(data + i)]--;
+    }
+
+    if (low > finder->gramLow)
+    {
+        finder->gramLow = low;
+    }
+
+    if (finder->size - pos < 3)
+    {
+        return FALSE;
+    }
+
+    return finder->gramCount[GRAM3(data + pos)] != 0;
 }
 
 /****************************************************************************
-*   Function   : DecodeLZSS
-*   Description: This function will read an LZss encoded input file and
-*                write an output file.  The encoded file uses a slight
-*                modification to the LZss algorithm.  I'm not sure who to
-*                credit with the slight modification to LZss, but the
-*                modification is to group the coded/not coded flag into
-*                bytes.  By grouping the flags, the need to be able to
-*                write anything other than a byte may be avoided as longs
-*                as strings encode as a whole byte multiple.  This algorithm
-*                encodes strings as 16 bits (a 12bit offset + a 4 bit length).
-*   Parameters : inFile - file to decode
-*                outFile - file to write decoded output
-*   Effects    : inFile is decoded and written to outFile
-*   Returned   : NONE
+*   Function   : CheckCandidate
+*   Description: This function applies the eb_ecl.exe rules to one
+*                candidate offset: count matching bytes up to
+*                min(remaining, offset), keep the candidate only if it is
+*                strictly longer than the best so far, and stop the search
+*                once a match is longer than MAX_LENGTH.
+*   Parameters : current - input at the position being encoded
+*                searchOffset - offset back to the candidate
+*                remaining - bytes left in the input from current
+*                matchData - best match so far, updated by the candidate
+*   Effects    : NONE
+*   Returned   : TRUE if the search is over, otherwise FALSE.
 ****************************************************************************/
-void DecodeLZSS(FILE *inFile, FILE *outFile)
+int CheckCandidate(const unsigned char *current, int searchOffset,
+    long remaining, encoded_string_t *matchData)
 {
-    int  i, c;
-    unsigned char flags, flagsUsed;     /* encoded/not encoded flag */
-    int nextChar;                       /* next char in sliding window */
-    encoded_string_t code;              /* offset/length code for string */
+    const unsigned char *candidate = current - searchOffset;
+    int maxCheck;
+    int matchLen;
 
-    /* initialize variables */
-    flags = 0;
-    flagsUsed = 7;
-    nextChar = 0;
+    /* Quick rejection: check byte at best length position */
+    if (matchData->length < remaining &&
+        current[matchData->length] != candidate[matchData->length])
+    {
+        return FALSE;
+    }
+
+    maxCheck = (remaining < (long)searchOffset) ? (int)remaining : searchOffset;
 
-    /************************************************************************
-    * Fill the sliding window buffer with some known vales.  EncodeLZSS must
-    * use the same values.  If common characters are used, there's an
-    * increased chance of matching to the earlier strings.
-    ************************************************************************/
-    for (i = 0; i < WINDOW_SIZE; i++)
+    /* past MAX_LENGTH + 1 the length no longer changes the outcome */
+    if (maxCheck > MAX_LENGTH + 1)
     {
-        slidingWindow[i] = 0x11;
+        maxCheck = MAX_LENGTH + 1;
     }
 
-    while (TRUE)
+    matchLen = MatchLength(current, candidate, maxCheck);
+
+    if (matchLen > matchData->length)
     {
-        flags <<= 1;
-        flagsUsed++;
+        matchData->length = matchLen;
+        matchData->offset = searchOffset;
+    }
 
-        if (flagsUsed == 8)
-        {
-            /* shifted out all the flag bits, read a new flag */
-            if ((c = getc(inFile)) == EOF)
-            {
-                break;
-            }
+    /* eb_ecl.exe: when match exceeds max_length, cap and exit */
+    if (matchLen > MAX_LENGTH)
+    {
+        matchData->length = MAX_LENGTH;
+        matchData->offset = searchOffset;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/****************************************************************************
+*   Function   : HashChainMatch
+*   Description: This function finds the eb_ecl.exe match at the given
+*                input position using hash chains of 3 byte strings.  A
+*                chain lists earlier positions from nearest to furthest, so
+*                candidates are still tested in order of increasing offset
+*                and ties resolve exactly as they do in BruteForceMatch.
+*                Offsets skipped by the chain can't start a match of 3 or
+*                more bytes, so they could never have changed the result.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                firstOffset - first offset to search (3 for a full search)
+*                matchData - best match at offsets below firstOffset, a
+*                            length of 2 if there is none
+*   Effects    : Positions up to pos - 3 are added to the hash chains
+*   Returned   : The offset back from pos where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+encoded_string_t HashChainMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData)
+{
+    const unsigned char *data;
+    long searchLimit;
+    long remaining;
+    long candidatePos;
+    long i;
 
-            flags = c & 0xFF;
-            flagsUsed = 0;
+    data = finder->data;
+    remaining = finder->size - pos;
+    searchLimit = (pos <= WINDOW_SIZE) ? pos : WINDOW_SIZE;
+
+    if (finder->nextInsert > pos - 2 && finder->nextInsert > 0)
+    {
+        /* searching backwards, chains hold offsets below 3 */
+        for (i = 0; i < HASH_SIZE; i++)
+        {
+            finder->hashHead[i] = -1;
         }
 
-        if ((flags & 0x80) == 0)
+        finder->nextInsert = 0;
+    }
+
+    /* positions further back than the window can never be candidates */
+    if (finder->nextInsert < pos - WINDOW_SIZE)
+    {
+        finder->nextInsert = pos - WINDOW_SIZE;
+    }
+
+    /* offsets start at 3, so only strings ending before pos are chained */
+    for (i = finder->nextInsert; i <= pos - 3; i++)
+    {
+        unsigned long hash = HASH3(data + i);
+
+        finder->hashPrev[i & (CHAIN_SIZE - 1)] = finder->hashHead[hash];
+        finder->hashHead[hash] = i;
+    }
+
+    if (i > finder->nextInsert)
+    {
+        finder->nextInsert = i;
+    }
+
+    if (remaining < 3)
+    {
+        /* not enough left for a match */
+        matchData.length = 0;
+        matchData.offset = 0;
+        return matchData;
+    }
+
+    candidatePos = finder->hashHead[HASH3(data + pos)];
+
+    while (candidatePos >= 0 && pos - candidatePos <= searchLimit)
+    {
+        const unsigned char *current = data + pos;
+        const unsigned char *candidate = data + candidatePos;
+        int searchOffset = (int)(pos - candidatePos);
+
+        candidatePos = finder->hashPrev[candidatePos & (CHAIN_SIZE - 1)];
+
+        if (searchOffset < firstOffset)
         {
-            /* uncoded character */
-            if ((c = getc(inFile)) == EOF)
-            {
-                break;
-            }
+            continue;
+        }
 
-            /* write out byte and put it in sliding window */
-            putc(c, outFile);
-            slidingWindow[nextChar] = c;
-            nextChar = (nextChar + 1) % WINDOW_SIZE;
+        /* Quick rejection: check first byte, the hash may collide */
+        if (*current != *candidate)
+        {
+            continue;
         }
-        else
+
+        if (CheckCandidate(current, searchOffset, remaining, &matchData))
         {
-            /* offset and length */
-            if ((code.length = getc(inFile)) == EOF)
-            {
-                break;
-            }
+            break;
+        }
+    }
 
-            if ((code.offset = getc(inFile)) == EOF)
-            {
-                break;
-            }
+    if (matchData.length <= 2)
+    {
+        matchData.length = 0;
+        matchData.offset = 0;
+    }
+
+    return matchData;
+}
 
+/****************************************************************************
+*   Function   : HighestBit
+*   Description: This function finds the most significant set bit.
+*   Parameters : value - non-zero value to search
+*   Effects    : NONE
+*   Returned   : Index of the highest set bit, 0 for the least significant.
+****************************************************************************/
+int HighestBit(unsigned long long value)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    int bit;
 
-            /* unpack offset and length */
-            /* eb_ecl.exe format: offset is distance back from current position */
-            code.offset = (code.offset + ((code.length & 0x03) << 8));
-            code.length = (code.length >> 2);
+    for (bit = 63; (value & (1ULL << bit)) == 0; bit--);
 
-            /****************************************************************
-            * Write out decoded string to file and lookahead.  It would be
-            * nice to write to the sliding window instead of the lookahead,
-            * but we could end up overwriting the matching string with the
-            * new string if abs(offset - next char) < match length.
-            ****************************************************************/
-            for (i = 0; i < code.length; i++)
-            {
-                int src_pos;
-                if (nextChar >= code.offset) {
-                    src_pos = nextChar - code.offset + i;
-                } else {
-                    src_pos = WINDOW_SIZE - code.offset + nextChar + i;
-                }
-                c = slidingWindow[src_pos % WINDOW_SIZE];
-                putc(c, outFile);
-                uncodedLookahead[i] = c;
-            }
+    return bit;
+#endif
+}
 
-            /* write out decoded string to sliding window */
-            for (i = 0; i < code.length; i++)
-            {
-                slidingWindow[(nextChar + i) % WINDOW_SIZE] =
-                    uncodedLookahead[i];
-            }
+/****************************************************************************
+*   Function   : CandidateMaskScalar
+*   Description: This function compares the first 3 bytes at current with
+*                the 3 bytes starting at each of 32 consecutive positions.
+*   Parameters : block - first of the 32 positions to compare
+*                current - input at the position being encoded
+*   Effects    : NONE
+*   Returned   : Bit j is set if block + j starts with the same 3 bytes.
+****************************************************************************/
+unsigned long CandidateMaskScalar(const unsigned char *block,
+    const unsigned char *current)
+{
+    unsigned long mask;
+    int j;
 
-            nextChar = (nextChar + code.length) % WINDOW_SIZE;
+    mask = 0;
+
+    for (j = 0; j < 32; j++)
+    {
+        if (block[j] == current[0] && block[j + 1] == current[1] &&
+            block[j + 2] == current[2])
+        {
+            mask |= 1UL << j;
         }
     }
+
+    return mask;
+}
+
+#ifdef HAVE_X86_SIMD
+/****************************************************************************
+*   Function   : CandidateMaskSSE2
+*   Description: SSE2 version of CandidateMaskScalar.
+*   Parameters : block - first of the 32 positions to compare
+*                current - input at the position being encoded
+*   Effects    : NONE
+*   Returned   : Bit j is set if block + j starts with the same 3 bytes.
+****************************************************************************/
+__attribute__((target("sse2")))
+unsigned long CandidateMaskSSE2(const unsigned char *block,
+    const unsigned char *current)
+{
+    __m128i c0, c1, c2, eq;
+    unsigned long mask;
+    int j;
+
+    c0 = _mm_set1_epi8((char)current[0]);
+    c1 = _mm_set1_epi8((char)current[1]);
+    c2 = _mm_set1_epi8((char)current[2]);
+    mask = 0;
+
+    for (j = 0; j < 32; j += 16)
+    {
+        eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(block + j)), c0);
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(block + j + 1)), c1));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(block + j + 2)), c2));
+        mask |= (unsigned long)(unsigned)_mm_movemask_epi8(eq) << j;
+    }
+
+    return mask;
+}
+
+/****************************************************************************
+*   Function   : CandidateMaskAVX2
+*   Description: AVX2 version of CandidateMaskScalar.
+*   Parameters : block - first of the 32 positions to compare
+*                current - input at the position being encoded
+*   Effects    : NONE
+*   Returned   : Bit j is set if block + j starts with the same 3 bytes.
+****************************************************************************/
+__attribute__((target("avx2")))
+unsigned long CandidateMaskAVX2(const unsigned char *block,
+    const unsigned char *current)
+{
+    __m256i eq;
+
+    eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)block),
+        _mm256_set1_epi8((char)current[0]));
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(block + 1)),
+        _mm256_set1_epi8((char)current[1])));
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(block + 2)),
+        _mm256_set1_epi8((char)current[2])));
+    return (unsigned long)(unsigned)_mm256_movemask_epi8(eq);
+}
+#endif
+
+/****************************************************************************
+*   Function   : MatchLengthScalar
+*   Description: This function counts the bytes a and b have in common
+*                from the start, one byte at a time.
+*   Parameters : a, b - strings to compare
+*                maxLen - most bytes to compare
+*   Effects    : NONE
+*   Returned   : Length of the common prefix, at most maxLen.
+****************************************************************************/
+int MatchLengthScalar(const unsigned char *a, const unsigned char *b,
+    int maxLen)
+{
+    int len;
+
+    for (len = 0; len < maxLen && a[len] == b[len]; len++);
+
+    return len;
+}
+
+/****************************************************************************
+*   Function   : MatchLengthWord
+*   Description: This function counts the bytes a and b have in common
+*                from the start, 8 bytes at a time.  The first differing
+*                byte is the lowest set byte of the XOR of two words on a
+*                little endian machine.
+*   Parameters : a, b - strings to compare
+*                maxLen - most bytes to compare
+*   Effects    : NONE
+*   Returned   : Length of the common prefix, at most maxLen.
+****************************************************************************/
+int MatchLengthWord(const unsigned char *a, const unsigned char *b,
+    int maxLen)
+{
+    int len;
+
+    len = 0;
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len + 8 <= maxLen)
+    {
+        unsigned long long wordA, wordB;
+
+        memcpy(&wordA, a + len, 8);
+        memcpy(&wordB, b + len, 8);
+
+        if (wordA != wordB)
+        {
+            return len + __builtin_ctzll(wordA ^ wordB) / 8;
+        }
+
+        len += 8;
+    }
+#endif
+
+    for (; len < maxLen && a[len] == b[len]; len++);
+
+    return len;
+}
+
+#ifdef HAVE_X86_SIMD
+/****************************************************************************
+*   Function   : MatchLengthSSE2
+*   Description: SSE2 version of MatchLengthWord, 16 bytes at a time.
+*   Parameters : a, b - strings to compare
+*                maxLen - most bytes to compare
+*   Effects    : NONE
+*   Returned   : Length of the common prefix, at most maxLen.
+****************************************************************************/
+__attribute__((target("sse2")))
+int MatchLengthSSE2(const unsigned char *a, const unsigned char *b,
+    int maxLen)
+{
+    int len;
+
+    for (len = 0; len + 16 <= maxLen; len += 16)
+    {
+        unsigned diff;
+
+        diff = 0xFFFF & ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(a + len)),
+            _mm_loadu_si128((const __m128i *)(b + len))));
+
+        if (diff != 0)
+        {
+            return len + __builtin_ctz(diff);
+        }
+    }
+
+    return len + MatchLengthWord(a + len, b + len, maxLen - len);
+}
+
+/****************************************************************************
+*   Function   : MatchLengthAVX2
+*   Description: AVX2 version of MatchLengthWord, 32 bytes at a time.
+*   Parameters : a, b - strings to compare
+*                maxLen - most bytes to compare
+*   Effects    : NONE
+*   Returned   : Length of the common prefix, at most maxLen.
+****************************************************************************/
+__attribute__((target("avx2")))
+int MatchLengthAVX2(const unsigned char *a, const unsigned char *b,
+    int maxLen)
+{
+    int len;
+
+    for (len = 0; len + 32 <= maxLen; len += 32)
+    {
+        unsigned diff;
+
+        diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a + len)),
+            _mm256_loadu_si256((const __m256i *)(b + len))));
+
+        if (diff != 0)
+        {
+            return len + __builtin_ctz(diff);
+        }
+    }
+
+    return len + MatchLengthWord(a + len, b + len, maxLen - len);
+}
+#endif
+
+/****************************************************************************
+*   Function   : SelectKernels
+*   Description: This function picks the fastest version of each kernel
+*                that the CPU running the program supports.  A pointer is
+*                only written if it changes, so once the kernels have been
+*                picked, threads calling this don't race on them.
+*   Parameters : NONE
+*   Effects    : Kernel function pointers are set
+*   Returned   : NONE
+****************************************************************************/
+void SelectKernels(void)
+{
+    candidate_mask_t candidateMask;
+    match_length_t matchLength;
+    sha256_blocks_t sha256Blocks;
+#ifdef HAVE_X86_SIMD
+    unsigned int eax, ebx, ecx, edx;
+#endif
+
+    candidateMask = CandidateMaskScalar;
+    matchLength = MatchLengthWord;
+    sha256Blocks = Sha256BlocksScalar;
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.1") &&
+        __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+    {
+        sha256Blocks = Sha256BlocksSHA;
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        candidateMask = CandidateMaskAVX2;
+        matchLength = MatchLengthAVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        candidateMask = CandidateMaskSSE2;
+        matchLength = MatchLengthSSE2;
+    }
+#endif
+
+    if (CandidateMask != candidateMask)
+    {
+        CandidateMask = candidateMask;
+    }
+
+    if (MatchLength != matchLength)
+    {
+        MatchLength = matchLength;
+    }
+
+    if (Sha256Blocks != sha256Blocks)
+    {
+        Sha256Blocks = sha256Blocks;
+    }
+}
+
+/****************************************************************************
+*   Function   : SimdMatch
+*   Description: This function finds the eb_ecl.exe match at the given
+*                input position.  Offsets are taken 32 at a time and
+*                compared against the first 3 bytes at pos with a vector
+*                kernel.  The resulting mask is walked from the smallest
+*                offset up, so candidates are tested in the same order as
+*                BruteForceMatch and offsets that can't reach 3 bytes are
+*                never looked at individually.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                firstOffset - first offset to search (3 for a full search)
+*                matchData - best match at offsets below firstOffset, a
+*                            length of 2 if there is none
+*   Effects    : NONE
+*   Returned   : The offset back from pos where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+encoded_string_t SimdMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData)
+{
+    const unsigned char *current;
+    long remaining;
+    int searchLimit;
+    int blockOffset;
+
+    current = finder->data + pos;
+    remaining = finder->size - pos;
+    searchLimit = (pos <= WINDOW_SIZE) ? (int)pos : WINDOW_SIZE;
+
+    if (remaining < 3)
+    {
+        searchLimit = 0;
+    }
+
+    /* bit j of a block's mask is offset blockOffset + 31 - j */
+    for (blockOffset = firstOffset; blockOffset <= searchLimit;
+        blockOffset += 32)
+    {
+        unsigned long mask;
+        int count;
+
+        count = searchLimit - blockOffset + 1;
+
+        if (count > 32)
+        {
+            count = 32;
+        }
+
+        if (pos - blockOffset - 31 >= 0)
+        {
+            mask = CandidateMask(current - blockOffset - 31, current);
+            mask &= (0xFFFFFFFFUL << (32 - count)) & 0xFFFFFFFFUL;
+        }
+        else
+        {
+            /* block starts before the input */
+            const unsigned char *candidate;
+            int j;
+
+            mask = 0;
+
+            for (j = 0; j < count; j++)
+            {
+                candidate = current - blockOffset - j;
+
+                if (candidate[0] == current[0] &&
+                    candidate[1] == current[1] && candidate[2] == current[2])
+                {
+                    mask |= 1UL << (31 - j);
+                }
+            }
+        }
+
+        while (mask != 0)
+        {
+            int bit;
+
+            /* highest bit is the smallest offset */
+            bit = HighestBit(mask);
+
+            mask &= ~(1UL << bit);
+
+            if (CheckCandidate(current, blockOffset + 31 - bit, remaining,
+                &matchData))
+            {
+                return matchData;
+            }
+        }
+    }
+
+    if (matchData.length <= 2)
+    {
+        matchData.length = 0;
+        matchData.offset = 0;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : ShiftAndMatch
+*   Description: This function finds the eb_ecl.exe match at the given
+*                input position by following every offset at once.  Bit i
+*                of the alive vector stands for offset WINDOW_SIZE - i, and
+*                byteBits holds, for each byte value, a bit for every
+*                window position holding it.  ANDing the alive vector with
+*                the bits for the kth byte from pos, shifted to line up,
+*                leaves the offsets still matching after k + 1 bytes, and
+*                clearing offset k + 1 applies the min(remaining, offset)
+*                cap.  The last non-empty vector holds the longest matches,
+*                and its highest bit is the smallest offset, the one the
+*                OEM search keeps.  A vector that lasts past MAX_LENGTH
+*                gives the first offset to exceed it, where that search
+*                stops.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                firstOffset - first offset to search (3 for a full search)
+*                matchData - best match at offsets below firstOffset, a
+*                            length of 2 if there is none
+*   Effects    : byteBits is moved to cover the window and lookahead at pos
+*   Returned   : The offset back from pos where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+encoded_string_t ShiftAndMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData)
+{
+    const unsigned char *data;
+    unsigned long long alive[ALIVE_WORDS];
+    unsigned long long *bits;
+    long remaining, low, end, j;
+    int searchLimit, steps;
+    int firstBit, lastBit, bestBit, bestLen;
+    int k, w;
+
+    data = finder->data;
+    bits = finder->byteBits;
+    remaining = finder->size - pos;
+    searchLimit = (pos <= WINDOW_SIZE) ? (int)pos : WINDOW_SIZE;
+    steps = (remaining <= MAX_LENGTH) ? (int)remaining : MAX_LENGTH + 1;
+
+    /* byteBits must cover the window and the bytes that will be compared */
+    low = pos - searchLimit;
+    end = pos + steps;
+
+    if (finder->bitsLow > low || finder->bitsHigh < low)
+    {
+        memset(bits, 0, 256 * BITS_WORDS * sizeof(unsigned long long));
+        finder->bitsLow = low;
+        finder->bitsHigh = low;
+    }
+
+    for (j = finder->bitsHigh; j < end; j++)
+    {
+        if (j - BITS_RING >= finder->bitsLow)
+        {
+            /* reuse the slot of the position that leaves the ring */
+            long old = j - BITS_RING;
+
+            bits[data[old] * BITS_WORDS + ((old >> 6) & (BITS_WORDS - 1))] &=
+                ~(1ULL << (old & 63));
+            finder->bitsLow = old + 1;
+        }
+
+        bits[data[j] * BITS_WORDS + ((j >> 6) & (BITS_WORDS - 1))] |=
+            1ULL << (j & 63);
+    }
+
+    if (end > finder->bitsHigh)
+    {
+        finder->bitsHigh = end;
+    }
+
+    firstBit = WINDOW_SIZE - searchLimit;   /* furthest offset */
+    lastBit = WINDOW_SIZE - firstOffset;    /* nearest offset */
+
+    if (remaining < 3 || lastBit < firstBit)
+    {
+        lastBit = -1;
+    }
+
+    /* start with every offset from firstOffset to searchLimit alive */
+    for (w = 0; w < ALIVE_WORDS; w++)
+    {
+        if (w * 64 + 63 < firstBit || w * 64 > lastBit)
+        {
+            alive[w] = 0;
+            continue;
+        }
+
+        alive[w] = ~0ULL;
+
+        if (w * 64 < firstBit)
+        {
+            alive[w] &= ~0ULL << (firstBit - w * 64);
+        }
+
+        if (w * 64 + 63 > lastBit)
+        {
+            alive[w] &= ~0ULL >> (w * 64 + 63 - lastBit);
+        }
+    }
+
+    bestLen = 0;
+    bestBit = 0;
+
+    for (k = 0; k < steps && lastBit >= 0; k++)
+    {
+        const unsigned long long *byteBits;
+        unsigned long start;
+        unsigned long long any;
+        int shift, word, top;
+
+        /* offset k can't match more than k bytes */
+        if (k >= 3)
+        {
+            alive[(WINDOW_SIZE - k) >> 6] &= ~(1ULL << ((WINDOW_SIZE - k) & 63));
+        }
+
+        /* bit i of alive lines up with position pos - WINDOW_SIZE + i + k */
+        byteBits = bits + data[pos + k] * BITS_WORDS;
+        start = (unsigned long)(pos - WINDOW_SIZE + k) & (BITS_RING - 1);
+        word = (int)(start >> 6);
+        shift = (int)(start & 63);
+        any = 0;
+        top = 0;
+
+        for (w = 0; w < ALIVE_WORDS; w++)
+        {
+            unsigned long long eq;
+
+            eq = byteBits[(word + w) & (BITS_WORDS - 1)];
+
+            if (shift != 0)
+            {
+                eq = (eq >> shift) |
+                    (byteBits[(word + w + 1) & (BITS_WORDS - 1)] << (64 - shift));
+            }
+
+            alive[w] &= eq;
+
+            if (alive[w] != 0)
+            {
+                any = alive[w];
+                top = w;
+            }
+        }
+
+        if (any == 0)
+        {
+            break;
+        }
+
+        /* highest bit is the smallest offset with this length */
+        bestLen = k + 1;
+        bestBit = top * 64 + HighestBit(any);
+    }
+
+    if (bestLen > MAX_LENGTH)
+    {
+        /* the search stops at the first offset past MAX_LENGTH */
+        matchData.length = MAX_LENGTH;
+        matchData.offset = WINDOW_SIZE - bestBit;
+    }
+    else if (bestLen > matchData.length)
+    {
+        matchData.length = bestLen;
+        matchData.offset = WINDOW_SIZE - bestBit;
+    }
+
+    if (matchData.length <= 2)
+    {
+        matchData.length = 0;
+        matchData.offset = 0;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : LowestBit
+*   Description: This function finds the least significant set bit.
+*   Parameters : value - non-zero value to search
+*   Effects    : NONE
+*   Returned   : Index of the lowest set bit, 0 for the least significant.
+****************************************************************************/
+int LowestBit(unsigned long long value)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(value);
+#else
+    int bit;
+
+    for (bit = 0; (value & (1ULL << bit)) == 0; bit++);
+
+    return bit;
+#endif
+}
+
+/****************************************************************************
+*   Function   : BuildSuffixIndex
+*   Description: This function sorts every suffix of the input by its first
+*                MAX_LENGTH + 1 bytes, by prefix doubling with a counting
+*                sort per round, and records the prefix each suffix shares
+*                with the one sorted before it.  Longer prefixes never
+*                change a match, so the sort stops at that depth and
+*                suffixes agreeing that far are left in any order.
+*   Parameters : index - suffix index to fill in
+*                data - input being encoded
+*                size - number of bytes in data
+*   Effects    : Memory for the index is allocated
+*   Returned   : TRUE for success, otherwise FALSE.
+****************************************************************************/
+int BuildSuffixIndex(suffix_index_t *index, const unsigned char *data,
+    long size)
+{
+    unsigned int *sa, *rank, *next, *count, *swap;
+    unsigned int classes;
+    long i, j, h, blocks;
+    int limit;
+
+    index->array = NULL;
+    index->rank = NULL;
+    index->lcp = NULL;
+    index->lcpMin64 = NULL;
+    index->lcpMin4096 = NULL;
+
+    if (size < 1 || (unsigned long)size > 0xFFFFFFFFUL)
+    {
+        /* positions are kept in 32 bits */
+        return FALSE;
+    }
+
+    sa = (unsigned int *)malloc(size * sizeof(unsigned int));
+    rank = (unsigned int *)malloc(size * sizeof(unsigned int));
+    next = (unsigned int *)malloc(size * sizeof(unsigned int));
+    count = (unsigned int *)malloc((size + 0x20001) * sizeof(unsigned int));
+    index->lcp = (unsigned char *)malloc(size);
+    index->lcpMin64 = (unsigned char *)malloc(size / 64 + 1);
+    index->lcpMin4096 = (unsigned char *)malloc(size / 4096 + 1);
+
+    if (sa == NULL || rank == NULL || next == NULL || count == NULL ||
+        index->lcp == NULL || index->lcpMin64 == NULL ||
+        index->lcpMin4096 == NULL)
+    {
+        free(sa);
+        free(rank);
+        free(next);
+        free(count);
+        FreeSuffixIndex(index);
+        return FALSE;
+    }
+
+    /* order by first 2 bytes, the last byte sorting before its pairs */
+    memset(count, 0, 0x20001 * sizeof(unsigned int));
+
+    for (i = 0; i < size; i++)
+    {
+        next[i] = (data[i] << 8 | ((i + 1 < size) ? data[i + 1] : 0)) * 2 +
+            ((i + 1 < size) ? 1 : 0);
+        count[next[i] + 1]++;
+    }
+
+    for (i = 1; i <= 0x20000; i++)
+    {
+        count[i] += count[i - 1];
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        sa[count[next[i]]++] = (unsigned int)i;
+    }
+
+    rank[sa[0]] = 0;
+
+    for (i = 1; i < size; i++)
+    {
+        rank[sa[i]] = rank[sa[i - 1]] + (next[sa[i]] != next[sa[i - 1]]);
+    }
+
+    classes = rank[sa[size - 1]] + 1;
+
+    for (h = 2; h <= MAX_LENGTH / 2 + 1 && classes < (unsigned long)size;
+        h *= 2)
+    {
+        /* suffixes are sorted by h bytes, order them by the h after that */
+        /* and let a stable sort on the first h bytes finish the job */
+        j = 0;
+
+        for (i = (size > h) ? size - h : 0; i < size; i++)
+        {
+            /* nothing after the first h bytes, these go first */
+            next[j++] = (unsigned int)i;
+        }
+
+        for (i = 0; i < size; i++)
+        {
+            if (sa[i] >= (unsigned long)h)
+            {
+                next[j++] = sa[i] - (unsigned int)h;
+            }
+        }
+
+        memset(count, 0, (classes + 1) * sizeof(unsigned int));
+
+        for (i = 0; i < size; i++)
+        {
+            count[rank[i] + 1]++;
+        }
+
+        for (i = 1; i <= (long)classes; i++)
+        {
+            count[i] += count[i - 1];
+        }
+
+        for (i = 0; i < size; i++)
+        {
+            sa[count[rank[next[i]]]++] = next[i];
+        }
+
+        /* suffixes agreeing on 2h bytes share a class */
+        next[sa[0]] = 0;
+
+        for (i = 1; i < size; i++)
+        {
+            long a = sa[i - 1];
+            long b = sa[i];
+            int same = (rank[a] == rank[b]) &&
+                (a + h < size) && (b + h < size) &&
+                (rank[a + h] == rank[b + h]);
+
+            next[b] = next[a] + (same ? 0 : 1);
+        }
+
+        swap = rank;
+        rank = next;
+        next = swap;
+        classes = rank[sa[size - 1]] + 1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        rank[sa[i]] = (unsigned int)i;
+    }
+
+    /* shared prefixes, no longer than a match can use */
+    index->lcp[0] = 0;
+
+    for (i = 1; i < size; i++)
+    {
+        long a = sa[i - 1];
+        long b = sa[i];
+
+        limit = MAX_LENGTH + 1;
+
+        if (size - a < limit)
+        {
+            limit = (int)(size - a);
+        }
+
+        if (size - b < limit)
+        {
+            limit = (int)(size - b);
+        }
+
+        index->lcp[i] = (unsigned char)MatchLength(data + a, data + b, limit);
+    }
+
+    /* block minimums, so a range is scanned 64 or 4096 entries at a time */
+    blocks = size / 64 + 1;
+
+    for (i = 0; i < blocks; i++)
+    {
+        index->lcpMin64[i] = MAX_LENGTH + 1;
+    }
+
+    for (i = 0; i < size / 4096 + 1; i++)
+    {
+        index->lcpMin4096[i] = MAX_LENGTH + 1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if (index->lcp[i] < index->lcpMin64[i / 64])
+        {
+            index->lcpMin64[i / 64] = index->lcp[i];
+        }
+
+        if (index->lcp[i] < index->lcpMin4096[i / 4096])
+        {
+            index->lcpMin4096[i / 4096] = index->lcp[i];
+        }
+    }
+
+    free(next);
+    free(count);
+    index->array = sa;
+    index->rank = rank;
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : FreeSuffixIndex
+*   Description: This function releases the arrays of a suffix index.
+*   Parameters : index - suffix index to free
+*   Effects    : Memory for the index is freed
+*   Returned   : NONE
+****************************************************************************/
+void FreeSuffixIndex(suffix_index_t *index)
+{
+    free(index->array);
+    free(index->rank);
+    free(index->lcp);
+    free(index->lcpMin64);
+    free(index->lcpMin4096);
+    index->array = NULL;
+    index->rank = NULL;
+    index->lcp = NULL;
+    index->lcpMin64 = NULL;
+    index->lcpMin4096 = NULL;
+}
+
+/****************************************************************************
+*   Function   : LcpRangeMin
+*   Description: This function finds the shortest prefix shared by
+*                neighbouring suffixes from first to last in sorted order,
+*                which is the prefix shared by the suffixes at first - 1
+*                and last.
+*   Parameters : index - suffix index
+*                first - first entry of the range
+*                last - last entry of the range
+*                limit - highest value to return
+*                floor - value below which the exact result isn't needed
+*   Effects    : NONE
+*   Returned   : The smallest lcp entry in the range, at most limit, or
+*                any value below floor if the smallest is.
+****************************************************************************/
+int LcpRangeMin(const suffix_index_t *index, long first, long last,
+    int limit, int floor)
+{
+    int value;
+
+    while (first <= last && limit >= floor)
+    {
+        if (first % 4096 == 0 && first + 4095 <= last)
+        {
+            value = index->lcpMin4096[first / 4096];
+            first += 4096;
+        }
+        else if (first % 64 == 0 && first + 63 <= last)
+        {
+            value = index->lcpMin64[first / 64];
+            first += 64;
+        }
+        else
+        {
+            value = index->lcp[first];
+            first++;
+        }
+
+        if (value < limit)
+        {
+            limit = value;
+        }
+    }
+
+    return limit;
+}
+
+/****************************************************************************
+*   Function   : SetWindowRank
+*   Description: This function adds or removes a position from the set of
+*                window positions, kept as a bit per sorted suffix with a
+*                bit per non-empty word above it.
+*   Parameters : finder - match finder state
+*                pos - position to add or remove
+*                set - TRUE to add pos, FALSE to remove it
+*   Effects    : windowRanks and windowWords are updated
+*   Returned   : NONE
+****************************************************************************/
+void SetWindowRank(match_finder_t *finder, long pos, int set)
+{
+    long rank = finder->suffixIndex->rank[pos];
+    long word = rank / 64;
+
+    if (set)
+    {
+        finder->windowRanks[word] |= 1ULL << (rank % 64);
+        finder->windowWords[word / 64] |= 1ULL << (word % 64);
+    }
+    else
+    {
+        finder->windowRanks[word] &= ~(1ULL << (rank % 64));
+
+        if (finder->windowRanks[word] == 0)
+        {
+            finder->windowWords[word / 64] &= ~(1ULL << (word % 64));
+        }
+    }
+}
+
+/****************************************************************************
+*   Function   : NextWindowRank
+*   Description: This function finds the next window position in sorted
+*                suffix order after a given rank.  Blocks of 4096 ranks
+*                holding no window position are skipped a summary bit at a
+*                time, and the search gives up at a skipped block whose
+*                smallest lcp entry is below floor, since every position
+*                past it shares fewer bytes than that with rank.
+*   Parameters : finder - match finder state
+*                rank - rank to search after
+*                floor - shared prefix below which a position is no use
+*   Effects    : NONE
+*   Returned   : The rank of the next window position, or -1 if there is
+*                none worth visiting.
+****************************************************************************/
+long NextWindowRank(const match_finder_t *finder, long rank, int floor)
+{
+    unsigned long long bits;
+    long word, summary;
+    long first = rank + 1;
+    long last = finder->size - 1;
+
+    rank++;
+
+    while (rank <= last)
+    {
+        word = rank / 64;
+        bits = finder->windowRanks[word] & (~0ULL << (rank % 64));
+
+        if (bits != 0)
+        {
+            return word * 64 + LowestBit(bits);
+        }
+
+        /* find the next non-empty word */
+        word++;
+
+        if (word * 64 > last)
+        {
+            return -1;
+        }
+
+        summary = word / 64;
+        bits = finder->windowWords[summary] & (~0ULL << (word % 64));
+
+        while (bits == 0)
+        {
+            summary++;
+
+            if (summary * 4096 > last ||
+                ((summary - 1) * 4096 >= first &&
+                finder->suffixIndex->lcpMin4096[summary - 1] < floor))
+            {
+                return -1;
+            }
+
+            bits = finder->windowWords[summary];
+        }
+
+        rank = (summary * 64 + LowestBit(bits)) * 64;
+    }
+
+    return -1;
+}
+
+/****************************************************************************
+*   Function   : PrevWindowRank
+*   Description: This function finds the previous window position in
+*                sorted suffix order before a given rank, skipping empty
+*                blocks the same way as NextWindowRank.
+*   Parameters : finder - match finder state
+*                rank - rank to search before
+*                floor - shared prefix below which a position is no use
+*   Effects    : NONE
+*   Returned   : The rank of the previous window position, or -1 if there
+*                is none worth visiting.
+****************************************************************************/
+long PrevWindowRank(const match_finder_t *finder, long rank, int floor)
+{
+    unsigned long long bits;
+    long word, summary;
+    long last = rank;
+
+    rank--;
+
+    while (rank >= 0)
+    {
+        word = rank / 64;
+        bits = finder->windowRanks[word] & (~0ULL >> (63 - rank % 64));
+
+        if (bits != 0)
+        {
+            return word * 64 + HighestBit(bits);
+        }
+
+        /* find the previous non-empty word */
+        word--;
+
+        if (word < 0)
+        {
+            return -1;
+        }
+
+        summary = word / 64;
+        bits = finder->windowWords[summary] & (~0ULL >> (63 - word % 64));
+
+        while (bits == 0)
+        {
+            if (summary == 0 ||
+                (summary * 4096 + 4095 <= last &&
+                finder->suffixIndex->lcpMin4096[summary] < floor))
+            {
+                return -1;
+            }
+
+            summary--;
+            bits = finder->windowWords[summary];
+        }
+
+        rank = (summary * 64 + HighestBit(bits)) * 64 + 63;
+    }
+
+    return -1;
+}
+
+/****************************************************************************
+*   Function   : SuffixMatch
+*   Description: This function finds the OEM match at pos from a suffix
+*                array of the whole input.  The window positions are kept
+*                as a set of ranks, and walking that set outwards from the
+*                rank of pos visits them in order of falling shared prefix,
+*                the running minimum of the lcp entries passed.  Each
+*                candidate's length is its shared prefix capped by its
+*                offset, and of equal lengths the smallest offset is kept,
+*                so once the shared prefix drops below the best length no
+*                later candidate can be chosen.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                firstOffset - first offset to search (3 for a full search)
+*                matchData - best match at offsets below firstOffset, a
+*                            length of 2 if there is none
+*   Effects    : The window set is moved to offsets 3 to WINDOW_SIZE from pos
+*   Returned   : The offset back from pos where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+encoded_string_t SuffixMatch(match_finder_t *finder, long pos,
+    int firstOffset, encoded_string_t matchData)
+{
+    const suffix_index_t *index = finder->suffixIndex;
+    long remaining, low, high, center, rank, next, i;
+    int limit, level, floor, length, offset, direction;
+
+    remaining = finder->size - pos;
+
+    /* the window holds the positions 3 to WINDOW_SIZE back from pos */
+    low = (pos > WINDOW_SIZE) ? pos - WINDOW_SIZE : 0;
+    high = (pos > 2) ? pos - 2 : 0;
+
+    if (low >= finder->windowHigh || high <= finder->windowLow)
+    {
+        for (i = finder->windowLow; i < finder->windowHigh; i++)
+        {
+            SetWindowRank(finder, i, FALSE);
+        }
+
+        finder->windowLow = low;
+        finder->windowHigh = low;
+    }
+
+    for (i = finder->windowLow; i < low; i++)
+    {
+        SetWindowRank(finder, i, FALSE);
+    }
+
+    for (i = high; i < finder->windowHigh; i++)
+    {
+        SetWindowRank(finder, i, FALSE);
+    }
+
+    for (i = low; i < finder->windowLow; i++)
+    {
+        SetWindowRank(finder, i, TRUE);
+    }
+
+    for (i = (finder->windowHigh > low) ? finder->windowHigh : low;
+        i < high; i++)
+    {
+        SetWindowRank(finder, i, TRUE);
+    }
+
+    finder->windowLow = low;
+    finder->windowHigh = high;
+
+    if (remaining < 3)
+    {
+        /* not enough left for a match */
+        matchData.length = 0;
+        matchData.offset = 0;
+        return matchData;
+    }
+
+    center = index->rank[pos];
+    limit = (remaining > MAX_LENGTH) ? MAX_LENGTH + 1 : (int)remaining;
+
+    for (direction = 0; direction < 2; direction++)
+    {
+        rank = center;
+        level = limit;
+
+        while (TRUE)
+        {
+            /* candidates sharing less than this can't be chosen */
+            floor = (matchData.length > 3) ? matchData.length : 3;
+
+            if (direction == 0)
+            {
+                next = NextWindowRank(finder, rank, floor);
+
+                if (next < 0)
+                {
+                    break;
+                }
+
+                level = LcpRangeMin(index, rank + 1, next, level, floor);
+            }
+            else
+            {
+                next = PrevWindowRank(finder, rank, floor);
+
+                if (next < 0)
+                {
+                    break;
+                }
+
+                level = LcpRangeMin(index, next + 1, rank, level, floor);
+            }
+
+            if (level < floor)
+            {
+                /* every candidate further out is shorter than the best */
+                break;
+            }
+
+            offset = (int)(pos - index->array[next]);
+            length = (level < offset) ? level : offset;
+
+            if (offset >= firstOffset &&
+                (length > matchData.length ||
+                (length == matchData.length && offset < matchData.offset)))
+            {
+                matchData.length = length;
+                matchData.offset = offset;
+            }
+
+            rank = next;
+        }
+    }
+
+    if (matchData.length > MAX_LENGTH)
+    {
+        /* the OEM search stops at the first offset to get past 63 bytes */
+        matchData.length = MAX_LENGTH;
+    }
+    else if (matchData.length <= 2)
+    {
+        matchData.length = 0;
+        matchData.offset = 0;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : RunMatch
+*   Description: This function works out the eb_ecl.exe search over the
+*                offsets that lie inside a run of one byte value ending at
+*                pos, such as erased flash or fill.  With back bytes of the
+*                run behind pos and fwd bytes from pos on, an offset
+*                d <= back matches min(d, fwd) bytes, so the first longest
+*                of those is offset min(back, fwd).  Once back and fwd both
+*                exceed MAX_LENGTH, offset MAX_LENGTH + 1 is the first to
+*                go past MAX_LENGTH and ends the search, which gives the
+*                steady state token of every long run without a scan.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                matchData - set to the best match inside the run
+*   Effects    : The run containing pos is remembered for the next call
+*   Returned   : The first offset still to be searched, or 0 if the search
+*                is complete and matchData is the result.
+****************************************************************************/
+int RunMatch(match_finder_t *finder, long pos, encoded_string_t *matchData)
+{
+    const unsigned char *data;
+    long back, fwd;
+
+    data = finder->data;
+
+    if (pos < 3 || finder->size - pos < 3)
+    {
+        return 3;
+    }
+
+    if (pos <= finder->runStart || pos >= finder->runEnd)
+    {
+        if (data[pos - 1] != data[pos])
+        {
+            return 3;
+        }
+
+        /* longer than the window back makes no difference, so stop there */
+        finder->runStart = pos - 1;
+
+        while (finder->runStart > 0 && pos - finder->runStart < WINDOW_SIZE &&
+            data[finder->runStart - 1] == data[pos])
+        {
+            finder->runStart--;
+        }
+
+        finder->runEnd = pos + 1;
+        finder->runClosed = FALSE;
+    }
+
+    /* find out if the run outlasts MAX_LENGTH, checking a block at a time */
+    /* so a long run is read once however many searches start in it */
+    if (finder->runEnd - pos <= MAX_LENGTH && !finder->runClosed)
+    {
+        long limit = finder->runEnd + LOOKAHEAD_BLOCK;
+
+        if (limit > finder->size)
+        {
+            limit = finder->size;
+        }
+
+        while (finder->runEnd < limit && data[finder->runEnd] == data[pos])
+        {
+            finder->runEnd++;
+        }
+
+        finder->runClosed = (finder->runEnd < limit ||
+            finder->runEnd == finder->size);
+    }
+
+    back = pos - finder->runStart;
+    fwd = finder->runEnd - pos;
+
+    if (back > WINDOW_SIZE)
+    {
+        back = WINDOW_SIZE;
+    }
+
+    if (back > MAX_LENGTH && fwd > MAX_LENGTH)
+    {
+        matchData->length = MAX_LENGTH;
+        matchData->offset = MAX_LENGTH + 1;
+        return 0;
+    }
+
+    if (back >= 3 && fwd >= 3)
+    {
+        matchData->length = (int)((back < fwd) ? back : fwd);
+        matchData->offset = matchData->length;
+    }
+
+    return (int)back + 1;
+}
+
+/****************************************************************************
+*   Function   : FindPeriod
+*   Description: This function looks for a repeating region continuing at
+*                pos after a match of MAX_LENGTH at periodOffset.  A region
+*                with shortest period p below MAX_LENGTH + 1 produces that
+*                match at the first multiple of p past MAX_LENGTH, so only
+*                divisors of periodOffset are tried, smallest first.  The
+*                first p where the MAX_LENGTH + 1 bytes from pos and that
+*                multiple of p bytes before pos repeat with period p is the
+*                shortest period of those bytes.
+*   Parameters : finder - match finder state
+*                pos - position following the MAX_LENGTH match
+*   Effects    : The region found, if any, replaces the remembered region
+*   Returned   : NONE
+****************************************************************************/
+void FindPeriod(match_finder_t *finder, long pos)
+{
+    const unsigned char *data;
+    long end;
+    int p, d;
+
+    data = finder->data;
+
+    for (p = 1; p <= MAX_LENGTH && p <= finder->periodOffset; p++)
+    {
+        if (finder->periodOffset % p != 0)
+        {
+            continue;
+        }
+
+        /* first multiple of p longer than MAX_LENGTH */
+        d = (MAX_LENGTH + p) / p * p;
+        end = pos + MAX_LENGTH + 1;
+
+        if (pos < d || end > finder->size)
+        {
+            continue;
+        }
+
+        if (memcmp(data + pos - d + p, data + pos - d, end - pos + d - p) != 0)
+        {
+            continue;
+        }
+
+        /* PeriodMatch finds the end of the region as it gets there */
+        finder->period = p;
+        finder->periodStart = pos - d;
+        finder->periodEnd = end;
+        finder->periodClosed = FALSE;
+        return;
+    }
+}
+
+/****************************************************************************
+*   Function   : PeriodMatch
+*   Description: This function produces the eb_ecl.exe match for positions
+*                well inside a region repeating with a short period p, such
+*                as vector tables or arrays of fixed size records.  With p
+*                the shortest period, an offset that isn't a multiple of p
+*                can't match more than MAX_LENGTH bytes, so the first match
+*                past MAX_LENGTH, which ends the search, is at the first
+*                multiple of p past MAX_LENGTH.  The start and end of a
+*                region are left to the match engine.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*                matchData - set to the match if pos is inside a region
+*   Effects    : May look for a new region at pos
+*   Returned   : TRUE if matchData holds the match, otherwise FALSE.
+****************************************************************************/
+int PeriodMatch(match_finder_t *finder, long pos,
+    encoded_string_t *matchData)
+{
+    int d;
+
+    if (pos == finder->periodCheck)
+    {
+        finder->periodCheck = -1;
+
+        if (pos <= finder->periodStart || pos >= finder->periodEnd)
+        {
+            FindPeriod(finder, pos);
+        }
+    }
+
+    if (finder->period == 0 || pos <= finder->periodStart ||
+        pos >= finder->periodEnd)
+    {
+        return FALSE;
+    }
+
+    if (finder->periodEnd - pos <= MAX_LENGTH && !finder->periodClosed)
+    {
+        /* check a block further ahead for the end of the region */
+        const unsigned char *data = finder->data;
+        long limit = finder->periodEnd + LOOKAHEAD_BLOCK;
+        long end = finder->periodEnd;
+
+        if (limit > finder->size)
+        {
+            limit = finder->size;
+        }
+
+        while (end + 256 <= limit &&
+            memcmp(data + end, data + end - finder->period, 256) == 0)
+        {
+            end += 256;
+        }
+
+        while (end < limit && data[end] == data[end - finder->period])
+        {
+            end++;
+        }
+
+        finder->periodEnd = end;
+        finder->periodClosed = (end < limit || end == finder->size);
+    }
+
+    if (finder->periodEnd - pos <= MAX_LENGTH)
+    {
+        return FALSE;
+    }
+
+    d = (MAX_LENGTH + finder->period) / finder->period * finder->period;
+
+    if (pos - finder->periodStart < d)
+    {
+        return FALSE;
+    }
+
+    matchData->length = MAX_LENGTH;
+    matchData->offset = d;
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : FindMatch
+*   Description: This function finds the eb_ecl.exe match at the given
+*                input position using the finder's engine.
+*   Parameters : finder - match finder state
+*                pos - position in the input to find a match for
+*   Effects    : Engine state may be advanced up to pos
+*   Returned   : The offset back from pos where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+encoded_string_t FindMatch(match_finder_t *finder, long pos)
+{
+    encoded_string_t matchData;
+    int firstOffset;
+
+    matchData.length = 2;  /* Must beat 2 (find >= 3) */
+    matchData.offset = 0;
+
+    /* offsets inside a run of one byte value are worked out directly */
+    firstOffset = RunMatch(finder, pos, &matchData);
+
+    if (firstOffset == 0)
+    {
+        return matchData;
+    }
+
+    /* so is the whole search inside a region with a short period */
+    if (PeriodMatch(finder, pos, &matchData))
+    {
+        return matchData;
+    }
+
+    if (finder->engine == ENGINE_CHAIN)
+    {
+        matchData = HashChainMatch(finder, pos, firstOffset, matchData);
+    }
+    else if (finder->engine == ENGINE_SHIFTAND)
+    {
+        matchData = ShiftAndMatch(finder, pos, firstOffset, matchData);
+    }
+    else if (finder->engine == ENGINE_SUFFIX)
+    {
+        matchData = SuffixMatch(finder, pos, firstOffset, matchData);
+    }
+    else if (matchData.length < 3 && !GramInWindow(finder, pos))
+    {
+        /* skip the scan for strings, such as encrypted data, not seen */
+        matchData.length = 0;
+        matchData.offset = 0;
+    }
+    else if (finder->engine == ENGINE_SIMD)
+    {
+        matchData = SimdMatch(finder, pos, firstOffset, matchData);
+    }
+    else
+    {
+        matchData = BruteForceMatch(finder->data, pos, finder->size,
+            firstOffset, matchData);
+    }
+
+    if (matchData.length == MAX_LENGTH && matchData.offset < 2 * MAX_LENGTH)
+    {
+        /* may be repeating, look for a period where this match ends */
+        finder->periodCheck = pos + MAX_LENGTH;
+        finder->periodOffset = matchData.offset;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : PoolWorker
+*   Description: This function is run by each thread of a thread pool.  It
+*                takes task numbers from the pool until there are none
+*                left.
+*   Parameters : arg - the pool_worker_t for the thread
+*   Effects    : Tasks are performed
+*   Returned   : 0
+****************************************************************************/
+#ifdef _WIN32
+DWORD WINAPI PoolWorker(LPVOID arg)
+#else
+void *PoolWorker(void *arg)
+#endif
+{
+    thread_pool_t *pool = ((pool_worker_t *)arg)->pool;
+    int worker = ((pool_worker_t *)arg)->worker;
+    long task;
+
+    while (TRUE)
+    {
+#ifdef _WIN32
+        EnterCriticalSection(&pool->lock);
+        task = pool->nextTask++;
+        LeaveCriticalSection(&pool->lock);
+#else
+        pthread_mutex_lock(&pool->lock);
+        task = pool->nextTask++;
+        pthread_mutex_unlock(&pool->lock);
+#endif
+
+        if (task >= pool->taskCount)
+        {
+            break;
+        }
+
+        pool->run(pool->context, task, worker);
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : RunThreadPool
+*   Description: This function performs tasks 0 to taskCount - 1 on up to
+*                threads threads, the calling thread being worker 0.  Tasks
+*                are handed out in order as threads become free, so each
+*                worker sees its tasks in increasing order.  If a thread
+*                can't be started the remaining threads pick up its share.
+*   Parameters : threads - number of threads to use
+*                taskCount - number of tasks
+*                run - function performing a task
+*                context - passed to every task
+*   Effects    : Every task is performed before returning
+*   Returned   : NONE
+****************************************************************************/
+void RunThreadPool(int threads, long taskCount, pool_task_t run,
+    void *context)
+{
+    thread_pool_t pool;
+    thread_t *handles;
+    pool_worker_t *workers;
+    pool_worker_t self;
+    int started, i;
+
+    pool.run = run;
+    pool.context = context;
+    pool.taskCount = taskCount;
+    pool.nextTask = 0;
+
+    if (threads > taskCount)
+    {
+        threads = (int)taskCount;
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    started = 0;
+    handles = (thread_t *)malloc(threads * sizeof(thread_t));
+    workers = (pool_worker_t *)malloc(threads * sizeof(pool_worker_t));
+
+    if (handles == NULL || workers == NULL)
+    {
+        /* do it all on this thread */
+        free(handles);
+        free(workers);
+        handles = NULL;
+        workers = &self;
+        threads = 1;
+        self.pool = &pool;
+        self.worker = 0;
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].worker = i;
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&pool.lock);
+
+    for (i = 1; i < threads; i++)
+    {
+        handles[started] = CreateThread(NULL, 0, PoolWorker, &workers[i], 0,
+            NULL);
+
+        if (handles[started] != NULL)
+        {
+            started++;
+        }
+    }
+#else
+    pthread_mutex_init(&pool.lock, NULL);
+
+    for (i = 1; i < threads; i++)
+    {
+        if (pthread_create(&handles[started], NULL, PoolWorker,
+            &workers[i]) == 0)
+        {
+            started++;
+        }
+    }
+#endif
+
+    PoolWorker(&workers[0]);
+
+    for (i = 0; i < started; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&pool.lock);
+#else
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    if (handles != NULL)
+    {
+        free(handles);
+        free(workers);
+    }
+}
+
+/****************************************************************************
+*   Function   : VerifyMatch
+*   Description: This function runs the original search for a position and
+*                reports any difference from the match an engine found.
+*   Parameters : data - input being encoded
+*                size - number of bytes in data
+*                pos - position the match was found for
+*                match - match found by the engine
+*   Effects    : A difference is reported on stderr
+*   Returned   : TRUE if the matches agree, otherwise FALSE.
+****************************************************************************/
+int VerifyMatch(const unsigned char *data, long size, long pos,
+    encoded_string_t match)
+{
+    encoded_string_t expected;
+
+    expected.length = 2;
+    expected.offset = 0;
+    expected = BruteForceMatch(data, pos, size, 3, expected);
+
+    if (match.length != expected.length || match.offset != expected.offset)
+    {
+        fprintf(stderr, "Match mismatch at %lx: brute force "
+            "length %d offset %d, engine length %d offset %d\n",
+            pos, expected.length, expected.offset,
+            match.length, match.offset);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : InitMatchTable
+*   Description: This function allocates what is needed to parse and pack
+*                the input in TABLE_CHUNK segments on a pool of threads.
+*   Parameters : table - match table to set up
+*                finder - match finder for the input, whose read only
+*                         tables the workers' finders share
+*                options - thread settings
+*                output - buffer of at least size + size / 8 + 1 bytes to
+*                         pack the groups straight into, or NULL to
+*                         allocate one
+*   Effects    : table is ready for EncodeSegments
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int InitMatchTable(match_table_t *table, const match_finder_t *finder,
+    const encode_options_t *options, unsigned char *output)
+{
+    long size = finder->size;
+
+    table->data = finder->data;
+    table->size = size;
+    table->shared = finder;
+    table->threads = options->threads;
+    table->verify = options->verify;
+    table->chunkSize = TABLE_CHUNK;
+    table->segmentCount = (size + TABLE_CHUNK - 1) / TABLE_CHUNK;
+    table->tokens = 0;
+    table->fullTokens = 0;
+    table->resumePos = 0;
+    table->outputSize = 0;
+
+    /* zeroed pages read as NO_ENTRY, first touched by the thread using them */
+    table->matches = (unsigned short *)calloc(size, sizeof(unsigned short));
+    table->segments = (parse_segment_t *)calloc(table->segmentCount,
+        sizeof(parse_segment_t));
+    table->finders = (match_finder_t *)malloc(table->threads *
+        sizeof(match_finder_t));
+    table->ready = (int *)calloc(table->threads, sizeof(int));
+
+    /* every byte a literal is the most a parse can take */
+    table->ownsOutput = (output == NULL);
+    table->output = (output != NULL) ? output :
+        (unsigned char *)malloc(size + size / 8 + 1);
+
+    if (table->matches == NULL || table->segments == NULL ||
+        table->finders == NULL || table->ready == NULL ||
+        table->output == NULL)
+    {
+        free(table->matches);
+        free(table->segments);
+        free(table->finders);
+        free(table->ready);
+
+        if (table->ownsOutput)
+        {
+            free(table->output);
+        }
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : FreeMatchTable
+*   Description: This function frees everything allocated for a match
+*                table.
+*   Parameters : table - match table to free
+*   Effects    : table may no longer be used
+*   Returned   : NONE
+****************************************************************************/
+void FreeMatchTable(match_table_t *table)
+{
+    int i;
+
+    for (i = 0; i < table->threads; i++)
+    {
+        if (table->ready[i])
+        {
+            FreeMatchFinder(&table->finders[i]);
+        }
+    }
+
+    free(table->matches);
+    free(table->segments);
+    free(table->finders);
+    free(table->ready);
+
+    if (table->ownsOutput)
+    {
+        free(table->output);
+    }
+}
+
+/****************************************************************************
+*   Function   : SpeculateTask
+*   Description: This function parses one segment of the input greedily as
+*                if a token started at its first byte, recording the match
+*                at each position the parse stops on.  The best match at a
+*                position depends only on the input, so each worker has
+*                its own match finder, which picks up the WINDOW_SIZE bytes
+*                before a segment as its window on the first search in it.
+*                Once this parse and the real one entering the segment stop
+*                on the same position they are the same parse from there
+*                on, see StitchSegments.
+*   Parameters : context - the match table
+*                task - number of the segment to parse
+*                worker - number of the worker doing the task
+*   Effects    : Entries for the segment and its speculative totals are set
+*   Returned   : NONE
+****************************************************************************/
+void SpeculateTask(void *context, long task, int worker)
+{
+    match_table_t *table = (match_table_t *)context;
+    parse_segment_t *segment;
+    match_finder_t *finder;
+    encoded_string_t match;
+    unsigned short entry;
+    long pos, end;
+
+    segment = &table->segments[task];
+    pos = task * table->chunkSize;
+    end = pos + table->chunkSize;
+
+    if (end > table->size)
+    {
+        end = table->size;
+    }
+
+    segment->specEnd = pos;
+    finder = &table->finders[worker];
+
+    if (!table->ready[worker])
+    {
+        if (!InitMatchFinder(finder, table->shared->engine, table->data,
+            table->size, table->shared))
+        {
+            /* leave the segment to StitchSegments */
+            return;
+        }
+
+        table->ready[worker] = TRUE;
+    }
+
+    while (pos < end)
+    {
+        match = FindMatch(finder, pos);
+        entry = PACK_MATCH(match);
+        table->matches[pos] = entry;
+        pos += ENTRY_LENGTH(entry);
+        segment->specTokens++;
+        segment->specBytes += ENTRY_BYTES(entry);
+    }
+
+    segment->specEnd = pos;
+}
+
+/****************************************************************************
+*   Function   : StitchSegments
+*   Description: This function follows the real parse through each segment
+*                until it stops on a position the speculative parse of the
+*                segment also stopped on, searching the positions before
+*                that itself, then jumps to the end of the speculative
+*                parse.  A greedy parse normally meets the speculative one
+*                within a few tokens, so little is searched here.
+*   Parameters : table - match table filled in by SpeculateTask
+*                finder - match finder for the positions searched here
+*   Effects    : Entries along the real parse are set and each segment is
+*                given the position and token and byte counts it starts at
+*   Returned   : NONE
+****************************************************************************/
+void StitchSegments(match_table_t *table, match_finder_t *finder)
+{
+    parse_segment_t *segment;
+    encoded_string_t match;
+    unsigned short entry;
+    long pos, spec, end, tokens, bytes;
+    long i;
+
+    pos = 0;
+    tokens = 0;
+    bytes = 0;
+
+    for (i = 0; i < table->segmentCount; i++)
+    {
+        segment = &table->segments[i];
+        segment->parseStart = pos;
+        segment->tokenBase = tokens;
+        segment->byteBase = bytes;
+        end = (i + 1) * table->chunkSize;
+
+        if (end > table->size)
+        {
+            end = table->size;
+        }
+
+        /* only the speculative parse has entries in the segment so far */
+        while (pos < end && table->matches[pos] == NO_ENTRY)
+        {
+            match = FindMatch(finder, pos);
+            entry = PACK_MATCH(match);
+            table->matches[pos] = entry;
+            pos += ENTRY_LENGTH(entry);
+            tokens++;
+            bytes += ENTRY_BYTES(entry);
+        }
+
+        if (pos < end)
+        {
+            /* the parses met, swap the speculative tokens before pos for */
+            /* the real ones counted above */
+            tokens += segment->specTokens;
+            bytes += segment->specBytes;
+
+            for (spec = i * table->chunkSize; spec < pos;
+                spec += ENTRY_LENGTH(entry))
+            {
+                entry = table->matches[spec];
+                tokens--;
+                bytes -= ENTRY_BYTES(entry);
+            }
+
+            pos = segment->specEnd;
+        }
+    }
+
+    /* PackTask moves these back to the last group if it is incomplete */
+    table->tokens = tokens;
+    table->fullTokens = tokens & ~7L;
+    table->resumePos = pos;
+    table->outputSize = tokens / 8 + bytes;
+}
+
+/****************************************************************************
+*   Function   : PackTask
+*   Description: This function writes the flag byte and codes of every
+*                group of 8 tokens that starts in one segment.  The token
+*                and byte counts from StitchSegments give the offset of
+*                each group in the output, so segments are packed in any
+*                order.  A group may take tokens from the next segment.
+*                Groups that aren't complete are left to the encoder.
+*   Parameters : context - the match table
+*                task - number of the segment to pack
+*                worker - number of the worker doing the task
+*   Effects    : Groups are written to the output, and the position of
+*                the first token not packed is set by the segment it is in
+*   Returned   : NONE
+****************************************************************************/
+void PackTask(void *context, long task, int worker)
+{
+    match_table_t *table = (match_table_t *)context;
+    parse_segment_t *segment;
+    unsigned char *out;
+    unsigned char flags, flagPos;
+    unsigned short entry;
+    long pos, token, bytes, last;
+    int next;
+
+    (void)worker;
+    segment = &table->segments[task];
+    pos = segment->parseStart;
+    token = segment->tokenBase;
+    bytes = segment->byteBase;
+    last = (task + 1 < table->segmentCount) ?
+        table->segments[task + 1].tokenBase : table->tokens;
+
+    if (last > table->fullTokens)
+    {
+        last = table->fullTokens;
+    }
+
+    /* the group these belong to was started by an earlier segment */
+    while (token < last && token % 8 != 0)
+    {
+        entry = table->matches[pos];
+        pos += ENTRY_LENGTH(entry);
+        bytes += ENTRY_BYTES(entry);
+        token++;
+    }
+
+    while (token < last)
+    {
+        out = table->output + token / 8 + bytes;
+        flags = 0;
+        next = 1;
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            encoded_string_t match;
+
+            entry = table->matches[pos];
+            match.length = (entry == LITERAL_ENTRY) ? 0 : entry >> 10;
+            match.offset = (entry == LITERAL_ENTRY) ? 0 : entry & 0x3FF;
+
+            if (table->verify &&
+                !VerifyMatch(table->data, table->size, pos, match))
+            {
+                segment->failed = TRUE;
+                return;
+            }
+
+            if (match.length > 0)
+            {
+                out[next++] = (unsigned char)((match.offset >> 8) |
+                    (match.length << 2));
+                out[next++] = (unsigned char)(match.offset & 0xFF);
+                flags |= flagPos;
+                pos += match.length;
+            }
+            else
+            {
+                out[next++] = table->data[pos];
+                pos++;
+            }
+        }
+
+        out[0] = flags;
+        bytes += next - 1;
+        token += 8;
+    }
+
+    if (segment->tokenBase <= table->fullTokens &&
+        table->fullTokens < table->tokens &&
+        (task + 1 == table->segmentCount ||
+        table->fullTokens < table->segments[task + 1].tokenBase))
+    {
+        /* the last incomplete group starts in this segment */
+        table->resumePos = pos;
+        table->outputSize = token / 8 + bytes;
+    }
+}
+
+/****************************************************************************
+*   Function   : EncodeSegments
+*   Description: This function encodes every complete group of 8 tokens of
+*                the input using a pool of threads.  Each thread parses
+*                segments speculatively, the parses are stitched into the
+*                real one, then each thread packs the groups starting in
+*                its segments.  The output is the same as encoding on one
+*                thread.
+*   Parameters : table - match table from InitMatchTable
+*                finder - match finder for positions searched while
+*                         stitching
+*                sink - output to write the groups to, or whose buffer
+*                       they were packed into
+*   Effects    : The groups are written to sink, resumePos is the first
+*                token left to encode and outputSize the bytes written
+*   Returned   : TRUE for success, FALSE if a match failed verification.
+****************************************************************************/
+int EncodeSegments(match_table_t *table, match_finder_t *finder,
+    output_sink_t *sink)
+{
+    long i;
+
+    RunThreadPool(table->threads, table->segmentCount, SpeculateTask, table);
+    StitchSegments(table, finder);
+    RunThreadPool(table->threads, table->segmentCount, PackTask, table);
+
+    for (i = 0; i < table->segmentCount; i++)
+    {
+        if (table->segments[i].failed)
+        {
+            return FALSE;
+        }
+    }
+
+    if (table->ownsOutput)
+    {
+        SinkWrite(sink, table->output, table->outputSize);
+    }
+    else
+    {
+        /* packed straight into the sink */
+        sink->size += table->outputSize;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : EncodeLZSS
+*   Description: This function will read an input file and write an output
+*                file encoded using the eb_ecl.exe LZSS variant.
+*                Rewritten to match eb_ecl.exe algorithm exactly:
+*                - Reads entire file into memory (mapped if it can be)
+*                - Searches directly in input buffer (no ring buffer)
+*                - Search from offset 3 upward
+*                An input that can't be sized, such as a pipe, is encoded
+*                as it is read instead, ENCODE_BLOCK bytes at a time.  A
+*                token is only searched for once MAX_LENGTH + 1 bytes
+*                after it have been read, or the input has ended, so it
+*                is the same token as for the whole file.  Only the
+*                suffix engine and -j read all of a pipe first.
+*   Parameters : inFile - file to encode
+*                outFile - file to write encoded output
+*                options - padding and match finder settings
+*   Effects    : inFile is encoded and written to outFile
+*   Returned   : TRUE for success, otherwise FALSE.
+****************************************************************************/
+int EncodeLZSS(FILE *inFile, FILE *outFile, const encode_options_t *options)
+{
+    unsigned char *inputData;
+    unsigned char flags, flagPos, encodedData[16];
+    int nextEncoded;
+    long inputSize, inputPos;
+    long compressedSize;
+    match_finder_t finder;
+    match_table_t table;
+    output_sink_t sink;
+    unsigned short *matchTable;
+    input_file_t input;
+    long inputBase, shift;
+    int inputEnd;
+    int i;
+
+    inputEnd = TRUE;
+    inputBase = 0;
+
+    /* Map entire file into memory (like eb_ecl.exe reading it) */
+    if (MapInputFile(&input, inFile))
+    {
+        inputData = input.data;
+        inputSize = input.size;
+    }
+    else if (options->threads > 1 || options->engine == ENGINE_SUFFIX)
+    {
+        /* these need the whole input, so read the pipe to its end */
+        inputData = LoadInputFile(&input, inFile) ? input.data : NULL;
+        inputSize = input.size;
+    }
+    else
+    {
+        /* a pipe, encode it as it is read */
+        inputData = (unsigned char *)malloc(ENCODE_BLOCK);
+        input.data = inputData;
+        input.map = NULL;
+
+        if (inputData != NULL)
+        {
+            inputSize = (long)fread(inputData, 1, ENCODE_BLOCK, inFile);
+            inputEnd = (inputSize < ENCODE_BLOCK);
+        }
+    }
+
+    if (inputData == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return FALSE;
+    }
+
+    if (inputSize == 0)
+    {
+        FreeInputFile(&input);
+        return TRUE;
+    }
+
+    if (!InitMatchFinder(&finder, options->engine, inputData, inputSize,
+        NULL))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeInputFile(&input);
+        return FALSE;
+    }
+
+    if (!InitOutputSink(&sink, outFile))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeMatchFinder(&finder);
+        FreeInputFile(&input);
+        return FALSE;
+    }
+
+    if (inputEnd)
+    {
+        /* every byte a literal, then padding, is the most output there is */
+        MapOutputSink(&sink, inputSize + (inputSize + 7) / 8 + ENCODE_PADDING);
+    }
+
+    matchTable = NULL;
+    inputPos = 0;
+    compressedSize = 0;
+
+    if (options->threads > 1 &&
+        InitMatchTable(&table, &finder, options,
+        sink.mapped ? sink.buffer : NULL))
+    {
+        /* complete groups are written, the last few tokens are done below */
+        if (!EncodeSegments(&table, &finder, &sink))
+        {
+            FreeOutputSink(&sink);
+            FreeMatchTable(&table);
+            FreeMatchFinder(&finder);
+            FreeInputFile(&input);
+            return FALSE;
+        }
+
+        if (options->index != NULL)
+        {
+            IndexGroups(options->index, table.output, table.outputSize,
+                inputData, inputSize);
+        }
+
+        matchTable = table.matches;
+        inputPos = table.resumePos;
+        compressedSize = table.outputSize;
+    }
+
+    flags = 0;
+    flagPos = 0x80;
+    nextEncoded = 0;
+
+    /* Process input like eb_ecl.exe does */
+    while (inputPos < inputSize)
+    {
+        encoded_string_t match;
+
+        if (!inputEnd && inputSize - inputPos <= MAX_LENGTH)
+        {
+            /* keep the window and what the finder reads behind it */
+            shift = (inputPos - BITS_RING) & ~(long)(BITS_RING - 1);
+
+            if (shift > 0)
+            {
+                SlideMatchFinder(&finder, shift);
+                memmove(inputData, inputData + shift, inputSize - shift);
+                inputSize -= shift;
+                inputPos -= shift;
+                inputBase += shift;
+            }
+
+            inputSize += (long)fread(inputData + inputSize, 1,
+                ENCODE_BLOCK - inputSize, inFile);
+            inputEnd = (inputSize < ENCODE_BLOCK);
+            finder.size = inputSize;
+        }
+
+        if (options->index != NULL && flagPos == 0x80 &&
+            inputBase + inputPos >= options->index->next)
+        {
+            /* the next flag byte goes at compressedSize */
+            AddCheckpoint(options->index, inputData + inputPos,
+                inputBase + inputPos, compressedSize);
+        }
+
+        if (matchTable != NULL && matchTable[inputPos] == LITERAL_ENTRY)
+        {
+            match.length = 0;
+            match.offset = 0;
+        }
+        else if (matchTable != NULL && matchTable[inputPos] != NO_ENTRY)
+        {
+            match.length = matchTable[inputPos] >> 10;
+            match.offset = matchTable[inputPos] & 0x3FF;
+        }
+        else
+        {
+            match = FindMatch(&finder, inputPos);
+        }
+
+        if (options->verify &&
+            !VerifyMatch(inputData, inputSize, inputPos, match))
+        {
+            if (matchTable != NULL)
+            {
+                FreeMatchTable(&table);
+            }
+
+            FreeOutputSink(&sink);
+            FreeMatchFinder(&finder);
+            FreeInputFile(&input);
+            return FALSE;
+        }
+
+        /* Encode the result */
+        if (match.length >= 3 && match.offset >= 3)
+        {
+            /* Match: encode as (length, offset) pair */
+            /* eb_ecl.exe format: byte1 = (length << 2) | (offset >> 8) */
+            /*                    byte2 = offset & 0xFF                 */
+            encodedData[nextEncoded++] = (unsigned char)((match.offset >> 8) | (match.length << 2));
+            encodedData[nextEncoded++] = (unsigned char)(match.offset & 0xFF);
+            flags |= flagPos;
+            inputPos += match.length;
+        }
+        else
+        {
+            /* Literal byte */
+            encodedData[nextEncoded++] = inputData[inputPos];
+            inputPos++;
+        }
+
+        if (flagPos == 0x01)
+        {
+            /* Write flags and encoded data */
+            SinkWriteGroup(&sink, flags, encodedData, nextEncoded);
+            compressedSize += 1 + nextEncoded;
+            flags = 0;
+            flagPos = 0x80;
+            nextEncoded = 0;
+        }
+        else
+        {
+            flagPos >>= 1;
+        }
+    }
+
+    /* write out any remaining encoded data */
+    if (nextEncoded != 0)
+    {
+        int totalSize = (compressedSize + nextEncoded + 1);
+        int remainder = 16 - (totalSize % 16);
+        /*
+        in exact mode, we need to treat padding bytes as a compression command
+        otherwise they will pollute the output length for decompressors which are not length restricted
+        */
+        if (options->exactPad && (totalSize % 16 != 0)) {
+            while ((compressedSize + nextEncoded + 1) % 16 != 0) {
+                if(flagPos == 0x00) {
+                    break;
+                }
+                remainder -= 2;
+                encodedData[nextEncoded++] = 0;
+                encodedData[nextEncoded++] = 0;
+                flags |= flagPos;
+                flagPos >>= 1;
+            }
+        }
+        SinkWriteGroup(&sink, flags, encodedData, nextEncoded);
+        compressedSize += 1 + nextEncoded;
+    }
+    /* 
+    We exhausted our input data, and might still have leftover bytes to fill 
+    we need to write out padding blocks that resolve to a no-op.
+    */
+    if (options->exactPad) {
+        int remainder = 16 - (compressedSize % 16);
+        int padding_lengths[17] = {0x0, 0x1, 0x12, 0x3, 0x14, 0x5, 0x16, 0x7, 0x18, 0x9, 0x1A, 0xB, 0x1C, 0xD, 0x1E, 0xF, 0x0};
+        unsigned char padding_block[17] = {0xFF, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+        remainder = padding_lengths[remainder];
+        for(i = 0; i < remainder; i++) {
+            SinkWrite(&sink, &padding_block[i % 0x11], 1);
+            compressedSize++;
+        }
+    }
+    if (options->dontPad == 0)
+    {
+        static const unsigned char zeros[0x10] = {0};
+
+        SinkWrite(&sink, zeros, (0x10 - compressedSize % 0x10) % 0x10);
+        compressedSize += (0x10 - compressedSize % 0x10) % 0x10;
+    }
+    fprintf(stderr, "%s%scompressedSize %lx\n",
+        (options->name != NULL) ? options->name : "",
+        (options->name != NULL) ? ": " : "", compressedSize);
+    if (matchTable != NULL)
+    {
+        FreeMatchTable(&table);
+    }
+
+    FreeMatchFinder(&finder);
+    FreeInputFile(&input);
+    return FreeOutputSink(&sink);
+}
+
+/****************************************************************************
+*   Function   : AddBatchFile
+*   Description: This function adds a file to a batch.  Without an output
+*                name the output is the input name with .lzss appended.
+*   Parameters : batch - batch to add to
+*                inName - file to encode, which must outlive the batch
+*                outName - file to write, or NULL
+*   Effects    : The file is added to the batch
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int AddBatchFile(batch_t *batch, const char *inName, const char *outName)
+{
+    batch_file_t *files, *file;
+    long capacity;
+
+    if (batch->count == batch->capacity)
+    {
+        capacity = (batch->capacity == 0) ? 64 : batch->capacity * 2;
+        files = (batch_file_t *)realloc(batch->files,
+            capacity * sizeof(batch_file_t));
+
+        if (files == NULL)
+        {
+            return FALSE;
+        }
+
+        batch->files = files;
+        batch->capacity = capacity;
+    }
+
+    file = &batch->files[batch->count];
+    file->inName = inName;
+    file->size = -1;
+    file->failed = FALSE;
+
+    if (outName != NULL)
+    {
+        file->outName = (char *)malloc(strlen(outName) + 1);
+
+        if (file->outName != NULL)
+        {
+            strcpy(file->outName, outName);
+        }
+    }
+    else
+    {
+        file->outName = (char *)malloc(strlen(inName) + sizeof(".lzss"));
+
+        if (file->outName != NULL)
+        {
+            strcpy(file->outName, inName);
+            strcat(file->outName, ".lzss");
+        }
+    }
+
+    if (file->outName == NULL)
+    {
+        return FALSE;
+    }
+
+    batch->count++;
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : ReadBatchManifest
+*   Description: This function adds the files listed in a manifest to a
+*                batch.  Each line names a file to encode, optionally
+*                followed by a tab and the file to write.  Empty lines are
+*                skipped.
+*   Parameters : batch - batch to add to
+*                manifestName - name of the manifest
+*   Effects    : The files are added to the batch, whose names point into
+*                the text of the manifest kept with the batch
+*   Returned   : TRUE for success, FALSE if the manifest can't be read or
+*                memory couldn't be allocated.
+****************************************************************************/
+int ReadBatchManifest(batch_t *batch, const char *manifestName)
+{
+    FILE *manifest;
+    unsigned char *data;
+    char *text, *line, *next, *tab;
+    long size, i;
+
+    manifest = fopen(manifestName, "rb");
+
+    if (manifest == NULL)
+    {
+        return FALSE;
+    }
+
+    data = ReadInputFile(manifest, &size);
+    fclose(manifest);
+
+    /* a copy ending in a newline, so every line ends in one */
+    text = (data != NULL) ? (char *)malloc(size + 2) : NULL;
+
+    if (text == NULL)
+    {
+        free(data);
+        return FALSE;
+    }
+
+    memcpy(text, data, size);
+    text[size] = '\n';
+    text[size + 1] = '\0';
+    free(data);
+    batch->manifest = text;
+
+    for (line = text; *line != '\0'; line = next)
+    {
+        next = strchr(line, '\n');
+        *next++ = '\0';
+
+        for (i = (long)strlen(line); i > 0 && line[i - 1] == '\r'; i--)
+        {
+            line[i - 1] = '\0';
+        }
+
+        if (*line == '\0')
+        {
+            continue;
+        }
+
+        tab = strchr(line, '\t');
+
+        if (tab != NULL)
+        {
+            *tab++ = '\0';
+        }
+
+        if (!AddBatchFile(batch, line, (tab != NULL && *tab != '\0') ?
+            tab : NULL))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : FreeBatch
+*   Description: This function frees the file list of a batch.
+*   Parameters : batch - batch to free
+*   Effects    : The output names, file list and manifest are freed
+*   Returned   : NONE
+****************************************************************************/
+void FreeBatch(batch_t *batch)
+{
+    long i;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        free(batch->files[i].outName);
+    }
+
+    free(batch->files);
+    free(batch->manifest);
+    batch->files = NULL;
+    batch->manifest = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+}
+
+/****************************************************************************
+*   Function   : CompareBatchFiles
+*   Description: This function orders batch files for qsort, largest
+*                first.
+*   Parameters : a, b - batch files to compare
+*   Effects    : NONE
+*   Returned   : Negative if a goes first, positive if b does, otherwise 0.
+****************************************************************************/
+int CompareBatchFiles(const void *a, const void *b)
+{
+    long sizeA = ((const batch_file_t *)a)->size;
+    long sizeB = ((const batch_file_t *)b)->size;
+
+    return (sizeA < sizeB) - (sizeA > sizeB);
+}
+
+/****************************************************************************
+*   Function   : BatchTask
+*   Description: This function encodes one file of a batch on one thread,
+*                exactly as encoding it on its own would.
+*   Parameters : context - the batch
+*                task - number of the file to encode
+*                worker - number of the worker doing the task
+*   Effects    : The file is encoded, failed is set if it couldn't be
+*   Returned   : NONE
+****************************************************************************/
+void BatchTask(void *context, long task, int worker)
+{
+    batch_t *batch = (batch_t *)context;
+    batch_file_t *file;
+    encode_options_t options;
+    FILE *inFile, *outFile;
+
+    (void)worker;
+    file = &batch->files[task];
+    options = *batch->options;
+    options.threads = 1;
+    options.index = NULL;
+    options.name = file->inName;
+
+    if ((inFile = fopen(file->inName, "rb")) == NULL)
+    {
+        fprintf(stderr, "Opening %s: %s\n", file->inName, strerror(errno));
+        file->failed = TRUE;
+        return;
+    }
+
+    if ((outFile = fopen(file->outName, "w+b")) == NULL)
+    {
+        fprintf(stderr, "Opening %s: %s\n", file->outName, strerror(errno));
+        fclose(inFile);
+        file->failed = TRUE;
+        return;
+    }
+
+    if (!EncodeLZSS(inFile, outFile, &options))
+    {
+        file->failed = TRUE;
+    }
+
+    fclose(inFile);
+
+    if (fclose(outFile) != 0)
+    {
+        file->failed = TRUE;
+    }
+}
+
+/****************************************************************************
+*   Function   : EncodeBatch
+*   Description: This function encodes every file of a batch, several at
+*                a time.  Each file is encoded on one thread, so its output
+*                is the same as encoding it on its own.  The pool hands
+*                the next file to whichever thread is free, and the files
+*                are taken largest first, so a large file is never left to
+*                start after the small ones and finish long after them.
+*   Parameters : batch - files to encode and the settings to use
+*                threads - number of files to encode at a time
+*   Effects    : The files are encoded and any that failed are reported
+*   Returned   : TRUE if every file was encoded, otherwise FALSE.
+****************************************************************************/
+int EncodeBatch(batch_t *batch, int threads)
+{
+    struct stat status;
+    long i;
+    int succeeded;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (stat(batch->files[i].inName, &status) == 0)
+        {
+            batch->files[i].size = (long)status.st_size;
+        }
+    }
+
+    qsort(batch->files, batch->count, sizeof(batch_file_t),
+        CompareBatchFiles);
+
+    /* picked here so the threads only ever read the kernel pointers */
+    SelectKernels();
+    RunThreadPool(threads, batch->count, BatchTask, batch);
+    succeeded = TRUE;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (batch->files[i].failed)
+        {
+            fprintf(stderr, "Failed to encode %s\n", batch->files[i].inName);
+            succeeded = FALSE;
+        }
+    }
+
+    return succeeded;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSS
+*   Description: This function will read an LZss encoded input file and
+*                write an output file.  The encoded file uses a slight
+*                modification to the LZss algorithm.  I'm not sure who to
+*                credit with the slight modification to LZss, but the
+*                modification is to group the coded/not coded flag into
+*                bytes.  By grouping the flags, the need to be able to
+*                write anything other than a byte may be avoided as longs
+*                as strings encode as a whole byte multiple.  This algorithm
+*                encodes strings as 16 bits (a 12bit offset + a 4 bit length).
+*                The input is decoded as a stream by DecodeLZSSStreaming,
+*                unless it is decoded on DECODE_MIN_THREADS or more threads
+*                or its decoded size is known.  Then it is mapped or read into memory
+*                first.  With a known size only that many bytes are
+*                decoded, and the rest of the input is checked to be the
+*                padding EncodeLZSS writes instead of being decoded.
+*   Parameters : inFile - file to decode
+*                outFile - file to write decoded output
+*                options - decoded size, if known, and threads
+*   Effects    : inFile is decoded and written to outFile
+*   Returned   : TRUE for success, otherwise FALSE.
+****************************************************************************/
+int DecodeLZSS(FILE *inFile, FILE *outFile, const decode_options_t *options)
+{
+    unsigned char *inputData, *outputData;
+    long inputSize, outputSize, padding;
+    decode_end_t end;
+    digest_t digest;
+    output_sink_t sink;
+    input_file_t input;
+    int written;
+
+    InitDigest(&digest, options->digests);
+
+    if (options->rangeLength >= 0)
+    {
+        if (!DecodeLZSSRange(inFile, outFile, options, &digest))
+        {
+            return FALSE;
+        }
+
+        ReportDigest(&digest, stderr);
+        return TRUE;
+    }
+
+    if (options->size < 0 && options->threads < DECODE_MIN_THREADS)
+    {
+        if (!DecodeLZSSStreaming(inFile, outFile, &digest, options->index))
+        {
+            return FALSE;
+        }
+
+        ReportDigest(&digest, stderr);
+        return TRUE;
+    }
+
+    if (!LoadInputFile(&input, inFile))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return FALSE;
+    }
+
+    inputData = input.data;
+    inputSize = input.size;
+
+    if (options->size >= 0)
+    {
+        /* one allocation, its last GROUP_OUTPUT bytes are decoded slowly */
+        outputData = (unsigned char *)malloc(options->size + 1);
+
+        if (outputData == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            FreeInputFile(&input);
+            return FALSE;
+        }
+
+        outputSize = DecodeLZSSPartial(inputData, inputSize, outputData,
+            options->size, &end);
+        UpdateDigest(&digest, outputData, outputSize);
+
+        if (options->index != NULL)
+        {
+            IndexGroups(options->index, inputData, inputSize, outputData,
+                outputSize);
+        }
+
+        written = InitOutputSink(&sink, outFile);
+
+        if (written)
+        {
+            SinkWrite(&sink, outputData, outputSize);
+            written = FreeOutputSink(&sink);
+        }
+
+        free(outputData);
+        ReportDigest(&digest, stderr);
+
+        if (!written)
+        {
+            FreeInputFile(&input);
+            return FALSE;
+        }
+
+        if (outputSize < options->size)
+        {
+            fprintf(stderr, "Input ends after %ld of %ld bytes\n",
+                outputSize, options->size);
+            FreeInputFile(&input);
+            return FALSE;
+        }
+
+        padding = PaddingEnd(inputData, inputSize, &end);
+        FreeInputFile(&input);
+
+        if (padding < inputSize)
+        {
+            fprintf(stderr, "Input byte %ld isn't padding\n", padding);
+            return FALSE;
+        }
+
+        fprintf(stderr, "Input ends with %ld bytes of padding\n",
+            inputSize - end.inPos);
+        return TRUE;
+    }
+
+    outputData = DecodeLZSSParallel(inputData, inputSize, options->threads,
+        &outputSize);
+
+    if (outputData == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeInputFile(&input);
+        return FALSE;
+    }
+
+    if (options->index != NULL)
+    {
+        IndexGroups(options->index, inputData, inputSize, outputData,
+            outputSize);
+    }
+
+    FreeInputFile(&input);
+
+    UpdateDigest(&digest, outputData, outputSize);
+    written = InitOutputSink(&sink, outFile);
+
+    if (written)
+    {
+        SinkWrite(&sink, outputData, outputSize);
+        written = FreeOutputSink(&sink);
+    }
+
+    free(outputData);
+    ReportDigest(&digest, stderr);
+    return written;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSStreaming
+*   Description: This function decodes a file a block at a time with a
+*                stream decoder, so memory use doesn't depend on the size
+*                of the file and pipes are decoded as data arrives.  A
+*                regular file is mapped and fed to the decoder whole.
+*   Parameters : inFile - file to decode
+*                outFile - file to write decoded output
+*                digest - digests to update with the decoded output
+*                index - index to add checkpoints to, or NULL
+*   Effects    : inFile is decoded and written to outFile
+*   Returned   : TRUE for success, otherwise FALSE.
+****************************************************************************/
+int DecodeLZSSStreaming(FILE *inFile, FILE *outFile, digest_t *digest,
+    checkpoint_index_t *index)
+{
+    stream_decoder_t decoder;
+    output_sink_t sink;
+    input_file_t input;
+    unsigned char *inputBlock;
+    size_t inputSize;
+
+    if (!InitStreamDecoder(&decoder))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return FALSE;
+    }
+
+    if (!InitOutputSink(&sink, outFile))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeStreamDecoder(&decoder);
+        return FALSE;
+    }
+
+    decoder.digest = digest;
+    decoder.index = index;
+
+    if (MapInputFile(&input, inFile))
+    {
+        /* a regular file is decoded straight from the page cache */
+        FeedStreamDecoder(&decoder, input.data, input.size);
+        DrainStreamToSink(&decoder, &sink);
+        FreeInputFile(&input);
+        FreeStreamDecoder(&decoder);
+        return FreeOutputSink(&sink);
+    }
+
+    inputBlock = (unsigned char *)malloc(STREAM_BLOCK);
+
+    if (inputBlock == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeOutputSink(&sink);
+        FreeStreamDecoder(&decoder);
+        return FALSE;
+    }
+
+    while ((inputSize = fread(inputBlock, 1, STREAM_BLOCK, inFile)) > 0)
+    {
+        FeedStreamDecoder(&decoder, inputBlock, (long)inputSize);
+        DrainStreamToSink(&decoder, &sink);
+    }
+
+    FreeStreamDecoder(&decoder);
+    free(inputBlock);
+    return FreeOutputSink(&sink);
+}
+
+/****************************************************************************
+*   Function   : DrainStreamToSink
+*   Description: This function drains a stream decoder straight into the
+*                buffer of an output sink until the data fed to it runs
+*                out, flushing the sink each time it fills.
+*   Parameters : decoder - stream decoder that has been fed
+*                sink - sink to drain into
+*   Effects    : Everything that can be decoded is written to the sink
+*   Returned   : NONE
+****************************************************************************/
+void DrainStreamToSink(stream_decoder_t *decoder, output_sink_t *sink)
+{
+    long space, drained;
+
+    do
+    {
+        space = sink->capacity - sink->size;
+        drained = DrainStreamDecoder(decoder, sink->buffer + sink->size,
+            space);
+        sink->size += drained;
+
+        if (sink->size == sink->capacity)
+        {
+            FlushOutputSink(sink);
+        }
+    } while (drained == space);
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSRange
+*   Description: This function decodes part of a file with a stream
+*                decoder.  With an index it starts from the last checkpoint
+*                at or before the range, seeking the input there (or
+*                reading up to it from a pipe), so at most the checkpoint
+*                interval and a group are decoded before the range starts.
+*                Without one it decodes from the start of the file.
+*   Parameters : inFile - file to decode
+*                outFile - file to write the range to
+*                options - the range and index to seek with
+*                digest - digests to update with the range
+*   Effects    : The range of the decoded output is written to outFile
+*   Returned   : TRUE for success, FALSE if the input ends before the end
+*                of the range or memory couldn't be allocated.
+****************************************************************************/
+int DecodeLZSSRange(FILE *inFile, FILE *outFile,
+    const decode_options_t *options, digest_t *digest)
+{
+    stream_decoder_t decoder;
+    output_sink_t sink;
+    unsigned char *inputBlock, *outputBlock;
+    size_t inputSize;
+    long outputSize, decodedPos, encodedPos, rangeEnd, from, to, checkpoint;
+    int written;
+
+    inputBlock = (unsigned char *)malloc(STREAM_BLOCK);
+    outputBlock = (unsigned char *)malloc(STREAM_BLOCK);
+
+    if (inputBlock == NULL || outputBlock == NULL ||
+        !InitStreamDecoder(&decoder))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(inputBlock);
+        free(outputBlock);
+        return FALSE;
+    }
+
+    if (!InitOutputSink(&sink, outFile))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        FreeStreamDecoder(&decoder);
+        free(inputBlock);
+        free(outputBlock);
+        return FALSE;
+    }
+
+    decodedPos = 0;
+    encodedPos = 0;
+    rangeEnd = options->rangeStart + options->rangeLength;
+
+    if (options->index != NULL)
+    {
+        checkpoint = FindCheckpoint(options->index, options->rangeStart);
+
+        if (checkpoint >= 0)
+        {
+            SeekStreamDecoder(&decoder, options->index, checkpoint);
+            decodedPos = options->index->positions[2 * checkpoint];
+            encodedPos = options->index->positions[2 * checkpoint + 1];
+        }
+    }
+
+    if (encodedPos > 0 && fseek(inFile, encodedPos, SEEK_SET) != 0)
+    {
+        /* a pipe can't seek */
+        while (encodedPos > 0 && (inputSize = fread(inputBlock, 1,
+            (encodedPos < STREAM_BLOCK) ? encodedPos : STREAM_BLOCK,
+            inFile)) > 0)
+        {
+            encodedPos -= (long)inputSize;
+        }
+    }
+
+    while (decodedPos < rangeEnd &&
+        (inputSize = fread(inputBlock, 1, STREAM_BLOCK, inFile)) > 0)
+    {
+        FeedStreamDecoder(&decoder, inputBlock, (long)inputSize);
+
+        while (decodedPos < rangeEnd && (outputSize =
+            DrainStreamDecoder(&decoder, outputBlock, STREAM_BLOCK)) > 0)
+        {
+            /* the part of the range in this block */
+            from = options->rangeStart - decodedPos;
+            to = rangeEnd - decodedPos;
+            from = (from < 0) ? 0 : from;
+            to = (to > outputSize) ? outputSize : to;
+
+            if (from < to)
+            {
+                UpdateDigest(digest, outputBlock + from, to - from);
+                SinkWrite(&sink, outputBlock + from, to - from);
+            }
+
+            decodedPos += outputSize;
+        }
+    }
+
+    FreeStreamDecoder(&decoder);
+    free(inputBlock);
+    free(outputBlock);
+    written = FreeOutputSink(&sink);
+
+    if (decodedPos < rangeEnd)
+    {
+        fprintf(stderr, "Input ends after %ld of %ld bytes\n", decodedPos,
+            rangeEnd);
+        return FALSE;
+    }
+
+    return written;
+}
+
+/****************************************************************************
+*   Function   : ReadInputFile
+*   Description: This function reads everything left in a file into memory.
+*                The file may be a pipe, so the buffer grows as it fills.
+*   Parameters : inFile - file to read
+*                size - set to the number of bytes read
+*   Effects    : inFile is read to its end
+*   Returned   : The bytes read, which the caller must free, or NULL if
+*                they couldn't be allocated.
+****************************************************************************/
+unsigned char *ReadInputFile(FILE *inFile, long *size)
+{
+    unsigned char *data, *grown;
+    long capacity;
+    size_t bytesRead;
+
+    *size = 0;
+    capacity = 64L * 1024;
+    data = (unsigned char *)malloc(capacity);
+
+    while (data != NULL)
+    {
+        bytesRead = fread(data + *size, 1, capacity - *size, inFile);
+        *size += (long)bytesRead;
+
+        if (*size < capacity)
+        {
+            break;
+        }
+
+        capacity *= 2;
+        grown = (unsigned char *)realloc(data, capacity);
+
+        if (grown == NULL)
+        {
+            free(data);
+        }
+
+        data = grown;
+    }
+
+    return data;
+}
+
+/****************************************************************************
+*   Function   : MapInputFile
+*   Description: This function maps what is left of a regular file into
+*                memory read only, so it is read straight from the page
+*                cache with no copy.  The mapping is advised to be read in
+*                order, so the kernel reads ahead and drops pages behind,
+*                and to use huge pages where the kernel can.  Pipes and
+*                other files that can't be mapped are left unread.
+*   Parameters : inFile - file to map
+*                input - set to the mapped bytes if the file is mapped
+*   Effects    : The file is mapped
+*   Returned   : TRUE if the file was mapped, otherwise FALSE.
+****************************************************************************/
+int MapInputFile(input_file_t *input, FILE *inFile)
+{
+#ifdef _WIN32
+    (void)input;
+    (void)inFile;
+    return FALSE;
+#else
+    struct stat status;
+    void *map;
+    long start;
+
+    if (fstat(fileno(inFile), &status) != 0 || !S_ISREG(status.st_mode) ||
+        (start = ftell(inFile)) < 0 || status.st_size <= start ||
+        status.st_size > LONG_MAX)
+    {
+        return FALSE;
+    }
+
+    map = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE,
+        fileno(inFile), 0);
+
+    if (map == MAP_FAILED)
+    {
+        return FALSE;
+    }
+
+    /* only hints, the mapping works the same if they are refused */
+    madvise(map, (size_t)status.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, (size_t)status.st_size, MADV_HUGEPAGE);
+#endif
+
+    input->map = map;
+    input->mapSize = (size_t)status.st_size;
+    input->data = (unsigned char *)map + start;
+    input->size = (long)status.st_size - start;
+    return TRUE;
+#endif
+}
+
+/****************************************************************************
+*   Function   : LoadInputFile
+*   Description: This function makes everything left in a file available
+*                in memory, mapping it if it is a regular file and reading
+*                it with ReadInputFile if it isn't.
+*   Parameters : input - set to the bytes of the file
+*                inFile - file to load
+*   Effects    : The file is mapped or read to its end
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int LoadInputFile(input_file_t *input, FILE *inFile)
+{
+    if (MapInputFile(input, inFile))
+    {
+        return TRUE;
+    }
+
+    input->map = NULL;
+    input->mapSize = 0;
+    input->data = ReadInputFile(inFile, &input->size);
+    return input->data != NULL;
+}
+
+/****************************************************************************
+*   Function   : FreeInputFile
+*   Description: This function unmaps or frees the bytes of an input file.
+*   Parameters : input - input from MapInputFile or LoadInputFile
+*   Effects    : input->data may no longer be used
+*   Returned   : NONE
+****************************************************************************/
+void FreeInputFile(input_file_t *input)
+{
+    if (input->map == NULL)
+    {
+        free(input->data);
+    }
+#ifndef _WIN32
+    else
+    {
+        munmap(input->map, input->mapSize);
+    }
+#endif
+
+    input->data = NULL;
+    input->map = NULL;
+}
+
+/****************************************************************************
+*   Function   : BuildFlagGroups
+*   Description: This function works out, for every flag byte, how many
+*                literals come before each offset/length code of its group
+*                and how many bytes of codes the group takes, which is
+*                8 + the number of codes.
+*   Parameters : NONE
+*   Effects    : FlagGroups is filled in the first time it is called
+*   Returned   : NONE
+****************************************************************************/
+void BuildFlagGroups(void)
+{
+    flag_group_t *group;
+    unsigned char flagPos;
+    unsigned char lengthBytes[GROUP_INPUT];
+    int flags, run, pos;
+
+    if (FlagGroups[0].size != 0)
+    {
+        /* already built */
+        return;
+    }
+
+    for (flags = 0xFF; flags >= 0; flags--)
+    {
+        group = &FlagGroups[flags];
+        group->matches = 0;
+        run = 0;
+        pos = 0;
+        memset(lengthBytes, 0, sizeof(lengthBytes));
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            if (flags & flagPos)
+            {
+                lengthBytes[pos] = 0xFC;
+                group->literals[group->matches++] = (unsigned char)run;
+                run = 0;
+                pos += 2;
+            }
+            else
+            {
+                run++;
+                pos++;
+            }
+        }
+
+        group->literals[group->matches] = (unsigned char)run;
+        group->size = (unsigned char)(8 + group->matches);
+
+        /* byte order doesn't matter if the masks are loaded as the input */
+        memcpy(group->lengthMasks, lengthBytes, sizeof(lengthBytes));
+    }
+}
+
+/****************************************************************************
+*   Function   : CopyMatch
+*   Description: This function copies a string from earlier in the output
+*                the way the eb_ecl.exe WINDOW_SIZE ring does, see
+*                DecodeLZSSPartial.
+*   Parameters : dst - output buffer
+*                outPos - position in dst to copy the string to
+*                offset - distance back to the string, 1 to WINDOW_SIZE
+*                length - number of bytes to copy
+*   Effects    : length bytes are written to dst at outPos
+*   Returned   : NONE
+****************************************************************************/
+void CopyMatch(unsigned char *dst, long outPos, int offset, int length)
+{
+    long from;
+    int i;
+
+    if (offset <= outPos && offset >= length)
+    {
+        /* the whole string is already in the output */
+        memcpy(dst + outPos, dst + outPos - offset, length);
+        return;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        from = outPos - offset + i;
+
+        if (i >= offset)
+        {
+            /* copied into the ring after this match */
+            from -= WINDOW_SIZE;
+        }
+
+        dst[outPos + i] = (from >= 0) ? dst[from] : 0x11;
+    }
+}
+
+/****************************************************************************
+*   Function   : CopyMatchWide
+*   Description: This function copies a string from earlier in the output
+*                COPY_WIDTH bytes at a time.  The moves may overlap when
+*                the offset is below COPY_WIDTH, so each is a memmove,
+*                which reads all of its bytes before writing them (one
+*                load and one store for a constant COPY_WIDTH).  As long
+*                as the string is no longer than its offset every byte of
+*                it is read from before outPos, so moves that run into
+*                bytes this copy wrote only carry them past the end of the
+*                string.  That holds for every match the encoder writes;
+*                the rest go through CopyMatch.
+*   Parameters : dst - output buffer, with COPY_WIDTH - 1 bytes of room
+*                      past the string
+*                outPos - position in dst to copy the string to
+*                offset - distance back to the string, 1 to WINDOW_SIZE
+*                length - number of bytes to copy
+*   Effects    : length bytes are written to dst at outPos, and the bytes
+*                up to the next multiple of COPY_WIDTH are overwritten
+*   Returned   : NONE
+****************************************************************************/
+void CopyMatchWide(unsigned char *dst, long outPos, int offset, int length)
+{
+    unsigned char *to;
+    const unsigned char *from;
+    int i;
+
+    if (offset < length || offset > outPos)
+    {
+        CopyMatch(dst, outPos, offset, length);
+        return;
+    }
+
+    to = dst + outPos;
+    from = to - offset;
+
+    for (i = 0; i < length; i += COPY_WIDTH)
+    {
+        memmove(to + i, from + i, COPY_WIDTH);
+    }
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSPartial
+*   Description: This function decodes an encoded buffer into an output
+*                buffer until the input ends or a token doesn't fit,
+*                reading matches straight from the output already written.
+*                It gives the same bytes as decoding through the eb_ecl.exe
+*                WINDOW_SIZE ring, which starts out filled with 0x11: an
+*                offset of 0 reads WINDOW_SIZE bytes back, bytes before the
+*                start of the output read as 0x11, and a match longer than
+*                its offset doesn't repeat itself but carries on with the
+*                bytes WINDOW_SIZE further back, since the ring isn't
+*                updated until the whole match is copied.  A stream ending
+*                part way through a code ends the output.
+*                While there is room for a whole group, the group is
+*                decoded from its FlagGroups entry: each run of literals is
+*                one 8 byte copy and each match a few wide copies, the
+*                bytes they write past the token being overwritten by the
+*                next.  The last GROUP_OUTPUT bytes of dst are the slack
+*                for that and are only ever decoded a byte at a time.
+*   Parameters : src - encoded data
+*                srcLen - number of bytes in src
+*                dst - buffer for the decoded data
+*                dstCap - number of bytes dst can hold
+*                end - set to where decoding stopped
+*   Effects    : The decoded data is written to dst.  A match that doesn't
+*                fit is copied as far as it fits.
+*   Returned   : The number of bytes decoded.
+****************************************************************************/
+long DecodeLZSSPartial(const unsigned char *src, long srcLen,
+    unsigned char *dst, long dstCap, decode_end_t *end)
+{
+    return DecodeLZSSFrom(src, srcLen, dst, dstCap, 0, 0, end);
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSFrom
+*   Description: This function carries on a decode by DecodeLZSSPartial
+*                from a flag byte it reached.
+*   Parameters : src - encoded data
+*                srcLen - number of bytes in src
+*                dst - buffer for the decoded data
+*                dstCap - number of bytes dst can hold
+*                inPos - flag byte to carry on from
+*                outPos - number of bytes decoded before it
+*                end - set to where decoding stopped
+*   Effects    : The rest of the decoded data is written to dst
+*   Returned   : The number of bytes decoded, including the first outPos.
+****************************************************************************/
+long DecodeLZSSFrom(const unsigned char *src, long srcLen,
+    unsigned char *dst, long dstCap, long inPos, long outPos,
+    decode_end_t *end)
+{
+    const flag_group_t *group;
+    unsigned char flags, flagPos;
+    int length, offset, i;
+
+    BuildFlagGroups();
+    flags = 0;
+    flagPos = 0;
+    end->overrun = FALSE;
+
+    while (inPos < srcLen)
+    {
+        flags = src[inPos++];
+
+        if (srcLen - inPos >= GROUP_INPUT && dstCap - outPos >= GROUP_OUTPUT)
+        {
+            group = &FlagGroups[flags];
+
+            for (i = 0; i < group->matches; i++)
+            {
+                memcpy(dst + outPos, src + inPos, 8);
+                outPos += group->literals[i];
+                inPos += group->literals[i];
+
+                length = src[inPos] >> 2;
+                offset = ((src[inPos] & 0x03) << 8) | src[inPos + 1];
+                inPos += 2;
+                CopyMatchWide(dst, outPos,
+                    (offset == 0) ? WINDOW_SIZE : offset, length);
+                outPos += length;
+            }
+
+            memcpy(dst + outPos, src + inPos, 8);
+            outPos += group->literals[i];
+            inPos += group->literals[i];
+            flagPos = 0;
+            continue;
+        }
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            if ((flags & flagPos) == 0)
+            {
+                /* uncoded character */
+                if (inPos >= srcLen)
+                {
+                    break;
+                }
+
+                if (outPos >= dstCap)
+                {
+                    end->overrun = TRUE;
+                    break;
+                }
+
+                dst[outPos++] = src[inPos++];
+                continue;
+            }
+
+            /* offset and length */
+            if (inPos + 1 >= srcLen)
+            {
+                break;
+            }
+
+            length = src[inPos] >> 2;
+            offset = ((src[inPos] & 0x03) << 8) | src[inPos + 1];
+
+            if (length > dstCap - outPos)
+            {
+                length = (int)(dstCap - outPos);
+                end->overrun = TRUE;
+            }
+
+            CopyMatch(dst, outPos, (offset == 0) ? WINDOW_SIZE : offset,
+                length);
+            outPos += length;
+
+            if (end->overrun)
+            {
+                break;
+            }
+
+            inPos += 2;
+        }
+
+        if (flagPos != 0)
+        {
+            /* stopped inside the group */
+            break;
+        }
+    }
+
+    end->inPos = inPos;
+    end->flags = flags;
+    end->flagPos = flagPos;
+    return outPos;
+}
+
+/****************************************************************************
+*   Function   : PaddingEnd
+*   Description: This function checks that the rest of the input after a
+*                decode stopped holds nothing but the padding EncodeLZSS
+*                writes: zero bytes filling out the last group and the
+*                alignment, zero length 0x00 0x00 codes, and the 0xFF flag
+*                bytes starting -e padding blocks.  Such input decodes to
+*                nothing, or to zero bytes that were never encoded.
+*   Parameters : src - encoded data
+*                srcLen - number of bytes in src
+*                end - where decoding stopped, from DecodeLZSSPartial
+*   Effects    : NONE
+*   Returned   : srcLen if the rest of the input is padding, otherwise the
+*                position of the first byte that isn't.
+****************************************************************************/
+long PaddingEnd(const unsigned char *src, long srcLen,
+    const decode_end_t *end)
+{
+    unsigned char flags, flagPos;
+    long inPos;
+
+    inPos = end->inPos;
+    flags = end->flags;
+    flagPos = end->flagPos;
+
+    while (inPos < srcLen)
+    {
+        if (flagPos == 0)
+        {
+            /* padding groups are all literals or all no-op codes */
+            flags = src[inPos];
+
+            if (flags != 0x00 && flags != 0xFF)
+            {
+                return inPos;
+            }
+
+            inPos++;
+            flagPos = 0x80;
+            continue;
+        }
+
+        /* literals and both bytes of a code are zero */
+        if (src[inPos] != 0)
+        {
+            return inPos;
+        }
+
+        inPos++;
+
+        if (flags & flagPos)
+        {
+            if (inPos < srcLen && src[inPos] != 0)
+            {
+                return inPos;
+            }
+
+            inPos++;
+        }
+
+        flagPos >>= 1;
+    }
+
+    return srcLen;
+}
+
+/****************************************************************************
+*   Function   : ProbeLZSS
+*   Description: This function reads an LZss encoded input file and reports
+*                its decoded size and where the padding at its end starts,
+*                without decoding it.
+*   Parameters : inFile - file to probe
+*                outFile - file to write the report to
+*   Effects    : The report is written to outFile
+*   Returned   : TRUE for success, otherwise FALSE.
+****************************************************************************/
+int ProbeLZSS(FILE *inFile, FILE *outFile)
+{
+    input_file_t input;
+    probe_t probe;
+
+    if (!LoadInputFile(&input, inFile))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return FALSE;
+    }
+
+    ProbeLZSSBuffer(input.data, input.size, &probe);
+    FreeInputFile(&input);
+
+    fprintf(outFile, "Decoded size: %ld\n", probe.size);
+    fprintf(outFile, "Padding starts at input byte %ld (decoded byte %ld)\n",
+        probe.paddingIn, probe.paddingOut);
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : ProbeLZSSBuffer
+*   Description: This function adds up the bytes an encoded buffer decodes
+*                to by walking its flag bytes and codes, never touching
+*                the decoded data.  Where a whole group is left it is
+*                measured by GroupOutput.  Where each group starts depends
+*                on the flag bytes before it, so there is nothing to do for
+*                several flag bytes at once.
+*                The padding EncodeLZSS writes (see PaddingEnd) is all
+*                0x00 and 0xFF bytes, so the groups after the last byte
+*                that is neither are walked again a token at a time to
+*                find the first position from which the rest of the input
+*                is padding.  Zero bytes at the end of the decoded data
+*                can't be told apart from padding and count as padding.
+*   Parameters : src - encoded data
+*                srcLen - number of bytes in src
+*                probe - set to the decoded size and where padding starts
+*   Effects    : NONE
+*   Returned   : The number of bytes src decodes to, as DecodeLZSSPartial.
+****************************************************************************/
+long ProbeLZSSBuffer(const unsigned char *src, long srcLen, probe_t *probe)
+{
+    unsigned char flags, flagPos;
+    long inPos, outPos, tailIn, tailOut, zeroFrom;
+
+    BuildFlagGroups();
+    zeroFrom = srcLen;
+
+    while (zeroFrom > 0 &&
+        (src[zeroFrom - 1] == 0x00 || src[zeroFrom - 1] == 0xFF))
+    {
+        zeroFrom--;
+    }
+
+    /* groups up to the last one starting before zeroFrom aren't padding */
+    inPos = 0;
+    outPos = 0;
+    tailIn = 0;
+    tailOut = 0;
+
+    while (srcLen - inPos > GROUP_INPUT && inPos < zeroFrom)
+    {
+        tailIn = inPos;
+        tailOut = outPos;
+        outPos += GroupOutput(src + inPos);
+        inPos += 1 + FlagGroups[src[inPos]].size;
+    }
+
+    if (inPos < zeroFrom)
+    {
+        tailIn = inPos;
+        tailOut = outPos;
+    }
+
+    /* the rest a token at a time, moving the padding start past each */
+    /* byte that can't be padding */
+    inPos = tailIn;
+    outPos = tailOut;
+    probe->paddingIn = inPos;
+    probe->paddingOut = outPos;
+
+    while (inPos < srcLen)
+    {
+        flags = src[inPos++];
+
+        if (flags != 0x00 && flags != 0xFF)
+        {
+            probe->paddingIn = inPos;
+            probe->paddingOut = outPos;
+        }
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            if ((flags & flagPos) == 0)
+            {
+                /* uncoded character */
+                if (inPos >= srcLen)
+                {
+                    break;
+                }
+
+                outPos++;
+
+                if (src[inPos++] != 0)
+                {
+                    probe->paddingIn = inPos;
+                    probe->paddingOut = outPos;
+                }
+
+                continue;
+            }
+
+            /* offset and length */
+            if (inPos + 1 >= srcLen)
+            {
+                /* an incomplete code ends the data */
+                if (inPos < srcLen && src[inPos] != 0)
+                {
+                    probe->paddingIn = srcLen;
+                    probe->paddingOut = outPos;
+                }
+
+                inPos = srcLen;
+                break;
+            }
+
+            outPos += src[inPos] >> 2;
+
+            if (src[inPos] != 0 || src[inPos + 1] != 0)
+            {
+                probe->paddingIn = inPos + 2;
+                probe->paddingOut = outPos;
+            }
+
+            inPos += 2;
+        }
+
+        if (flagPos != 0)
+        {
+            break;
+        }
+    }
+
+    probe->size = outPos;
+    return outPos;
+}
+
+/****************************************************************************
+*   Function   : GroupOutput
+*   Description: This function adds up the bytes a whole group decodes to.
+*                The group's FlagGroups entry masks the length bits of its
+*                codes out of the 24 bytes following the flag byte, read as
+*                3 words, so nothing depends on the number of codes.
+*   Parameters : src - the group's flag byte, followed by at least
+*                      GROUP_INPUT bytes
+*   Effects    : NONE
+*   Returned   : The number of bytes the group decodes to.
+****************************************************************************/
+long GroupOutput(const unsigned char *src)
+{
+    const flag_group_t *group;
+    unsigned long long words[3];
+    long length;
+    int i;
+
+    group = &FlagGroups[src[0]];
+    memcpy(words, src + 1, sizeof(words));
+    length = 8 - group->matches;
+
+    /* a word holds at most 4 lengths, so their sum fits the top byte of */
+    /* the multiply adding up its bytes */
+    for (i = 0; i < 3; i++)
+    {
+        length += (long)((((words[i] & group->lengthMasks[i]) >> 2) *
+            0x0101010101010101ULL) >> 56);
+    }
+
+    return length;
+}
+
+/****************************************************************************
+*   Function   : SplitDecodeChunks
+*   Description: This function walks the groups of an encoded buffer with
+*                GroupOutput, starting a new chunk at the first group after
+*                DECODE_CHUNK bytes of input and output together, so runs
+*                packed into long matches don't make one chunk much slower
+*                to decode than the rest.  The last few bytes may not hold
+*                a whole group and are left to the last chunk, so its end
+*                is only a bound until it is decoded.
+*   Parameters : table - decode table with src and srcLen set
+*   Effects    : The chunks and windows of table are allocated, the chunks
+*                are set, and dstCap is the most the buffer can decode to
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int SplitDecodeChunks(decode_table_t *table)
+{
+    decode_chunk_t *chunk, *grown;
+    long inPos, outPos, capacity;
+
+    capacity = 16;
+    table->chunkCount = 1;
+    table->chunks = (decode_chunk_t *)calloc(capacity,
+        sizeof(decode_chunk_t));
+    table->windows = NULL;
+
+    if (table->chunks == NULL)
+    {
+        return FALSE;
+    }
+
+    inPos = 0;
+    outPos = 0;
+
+    while (table->srcLen - inPos > GROUP_INPUT)
+    {
+        chunk = &table->chunks[table->chunkCount - 1];
+
+        if ((inPos - chunk->inPos) + (outPos - chunk->outPos) >=
+            DECODE_CHUNK)
+        {
+            if (table->chunkCount == capacity)
+            {
+                capacity *= 2;
+                grown = (decode_chunk_t *)realloc(table->chunks,
+                    capacity * sizeof(decode_chunk_t));
+
+                if (grown == NULL)
+                {
+                    free(table->chunks);
+                    return FALSE;
+                }
+
+                table->chunks = grown;
+                chunk = &table->chunks[table->chunkCount - 1];
+            }
+
+            chunk->inEnd = inPos;
+            chunk->outEnd = outPos;
+            memset(chunk + 1, 0, sizeof(decode_chunk_t));
+            chunk[1].inPos = inPos;
+            chunk[1].outPos = outPos;
+            table->chunkCount++;
+        }
+
+        outPos += GroupOutput(table->src + inPos);
+        inPos += 1 + FlagGroups[table->src[inPos]].size;
+    }
+
+    /* a code is 2 bytes of the tail, with a flag byte for every 8 */
+    chunk = &table->chunks[table->chunkCount - 1];
+    chunk->inEnd = table->srcLen;
+    chunk->outEnd = outPos + ((table->srcLen - inPos) / 2 + 1) * MAX_LENGTH;
+    table->dstCap = chunk->outEnd;
+    table->windows = (unsigned char *)malloc(table->chunkCount *
+        WINDOW_SIZE);
+
+    if (table->windows == NULL)
+    {
+        free(table->chunks);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : CopySymbols
+*   Description: This function copies a string of symbols from earlier in
+*                a chunk, or from its window, the way CopyMatch copies
+*                bytes.  A string with no window symbols that is no longer
+*                than its offset is moved 8 symbols at a time, like
+*                CopyMatchWide.
+*   Parameters : symbols - symbols of the chunk, with 7 symbols of room
+*                          past the string
+*                out - position in symbols to copy the string to
+*                offset - distance back to the string, 1 to WINDOW_SIZE
+*                length - number of symbols to copy
+*   Effects    : length symbols are written at out, and the 7 after them
+*                may be overwritten
+*   Returned   : The symbols copied ORed together, 256 or more if any of
+*                them stands for a window byte.
+****************************************************************************/
+unsigned short CopySymbols(unsigned short *symbols, long out, int offset,
+    int length)
+{
+    unsigned long long words[2], whole;
+    unsigned short symbol, copied, lanes[4];
+    long from;
+    int i;
+
+    copied = 0;
+
+    if (offset <= out && offset >= length)
+    {
+        whole = 0;
+
+        for (i = 0; i < length; i += 8)
+        {
+            memcpy(words, symbols + out - offset + i, sizeof(words));
+            memcpy(symbols + out + i, words, sizeof(words));
+
+            if (length - i >= 8)
+            {
+                whole |= words[0] | words[1];
+            }
+        }
+
+        /* the symbols of the last move that are part of the string */
+        for (i = length & ~7; i < length; i++)
+        {
+            copied |= symbols[out + i];
+        }
+
+        memcpy(lanes, &whole, sizeof(lanes));
+        return copied | lanes[0] | lanes[1] | lanes[2] | lanes[3];
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        from = out - offset + i;
+
+        if (i >= offset)
+        {
+            /* copied into the ring after this match */
+            from -= WINDOW_SIZE;
+        }
+
+        symbol = (from >= 0) ? symbols[from] :
+            (unsigned short)(256 + WINDOW_SIZE + from);
+        symbols[out + i] = symbol;
+        copied |= symbol;
+    }
+
+    return copied;
+}
+
+/****************************************************************************
+*   Function   : ExpandSymbols
+*   Description: This function starts decoding a chunk before the bytes in
+*                its window are known.  Each decoded byte is kept as a
+*                symbol: its value, or 256 + i for byte i of the window
+*                when it was copied from there, directly or through
+*                earlier matches.  Once WINDOW_SIZE bytes in a row have
+*                been decoded without window symbols, no match can reach
+*                one, and the rest of the chunk is decoded as bytes.
+*                Whole groups are decoded from their FlagGroups entry as
+*                in DecodeLZSSPartial.
+*   Parameters : table - the decode table
+*                chunk - chunk to decode
+*                inPos - set to the next flag byte to decode
+*                outPos - set to the position it decodes to
+*   Effects    : The symbols of the chunk are allocated and set, and their
+*                values are written to the output, window symbols as
+*                placeholders until ResolveTask
+*   Returned   : NONE
+****************************************************************************/
+void ExpandSymbols(decode_table_t *table, decode_chunk_t *chunk,
+    long *inPos, long *outPos)
+{
+    const flag_group_t *group;
+    const unsigned char *src;
+    unsigned short *symbols;
+    unsigned char flags, flagPos;
+    long in, out, clean, capacity;
+    int length, offset, i, j;
+
+    src = table->src;
+    *inPos = chunk->inPos;
+    *outPos = chunk->outPos;
+    capacity = chunk->outEnd - chunk->outPos;
+    symbols = (unsigned short *)malloc((capacity + GROUP_OUTPUT) *
+        sizeof(unsigned short));
+
+    if (symbols == NULL)
+    {
+        chunk->failed = TRUE;
+        return;
+    }
+
+    in = chunk->inPos;
+    out = 0;
+    clean = 0;      /* first of the bytes decoded without window symbols */
+    flagPos = 0;
+
+    while (in < chunk->inEnd && out - clean < WINDOW_SIZE)
+    {
+        flags = src[in++];
+
+        if (table->srcLen - in >= GROUP_INPUT &&
+            capacity - out >= GROUP_OUTPUT)
+        {
+            group = &FlagGroups[flags];
+
+            for (i = 0; i <= group->matches; i++)
+            {
+                for (j = 0; j < 8; j++)
+                {
+                    symbols[out + j] = src[in + j];
+                }
+
+                out += group->literals[i];
+                in += group->literals[i];
+
+                if (i == group->matches)
+                {
+                    break;
+                }
+
+                length = src[in] >> 2;
+                offset = ((src[in] & 0x03) << 8) | src[in + 1];
+                in += 2;
+
+                if (CopySymbols(symbols, out,
+                    (offset == 0) ? WINDOW_SIZE : offset, length) >= 256)
+                {
+                    clean = out + length;
+                }
+
+                out += length;
+            }
+
+            continue;
+        }
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            if ((flags & flagPos) == 0)
+            {
+                /* uncoded character */
+                if (in >= table->srcLen)
+                {
+                    break;
+                }
+
+                symbols[out++] = src[in++];
+                continue;
+            }
+
+            /* offset and length */
+            if (in + 1 >= table->srcLen)
+            {
+                break;
+            }
+
+            length = src[in] >> 2;
+            offset = ((src[in] & 0x03) << 8) | src[in + 1];
+            in += 2;
+
+            if (CopySymbols(symbols, out,
+                (offset == 0) ? WINDOW_SIZE : offset, length) >= 256)
+            {
+                clean = out + length;
+            }
+
+            out += length;
+        }
+
+        if (flagPos != 0)
+        {
+            /* stopped inside the group, the input ended */
+            in = table->srcLen;
+            break;
+        }
+    }
+
+    for (i = 0; i < out; i++)
+    {
+        table->dst[chunk->outPos + i] = (unsigned char)symbols[i];
+    }
+
+    chunk->symbols = symbols;
+    chunk->symbolCount = out;
+    *inPos = in;
+    *outPos = chunk->outPos + out;
+}
+
+/****************************************************************************
+*   Function   : ExpandTask
+*   Description: This function decodes one chunk of an encoded buffer into
+*                its place in the output, the same way as
+*                DecodeLZSSPartial.  Every chunk but the first starts with
+*                ExpandSymbols, as the bytes before it may not be decoded
+*                yet.  Whole groups are only decoded with wide copies while
+*                their slack stays inside the chunk, so threads never write
+*                the same bytes.
+*   Parameters : context - the decode table
+*                task - number of the chunk to decode
+*                worker - number of the worker doing the task
+*   Effects    : The chunk is decoded, apart from bytes copied from its
+*                window, and the end of the last chunk is set to where it
+*                ends
+*   Returned   : NONE
+****************************************************************************/
+void ExpandTask(void *context, long task, int worker)
+{
+    decode_table_t *table = (decode_table_t *)context;
+    decode_chunk_t *chunk;
+    const flag_group_t *group;
+    const unsigned char *src;
+    unsigned char *dst;
+    unsigned char flags, flagPos;
+    long inPos, outPos;
+    int length, offset, i;
+
+    (void)worker;
+    chunk = &table->chunks[task];
+    src = table->src;
+    dst = table->dst;
+    inPos = chunk->inPos;
+    outPos = chunk->outPos;
+
+    if (task > 0)
+    {
+        ExpandSymbols(table, chunk, &inPos, &outPos);
+
+        if (chunk->failed)
+        {
+            return;
+        }
+    }
+
+    while (inPos < chunk->inEnd)
+    {
+        flags = src[inPos++];
+
+        if (table->srcLen - inPos >= GROUP_INPUT &&
+            chunk->outEnd - outPos >= GROUP_OUTPUT)
+        {
+            group = &FlagGroups[flags];
+
+            for (i = 0; i < group->matches; i++)
+            {
+                memcpy(dst + outPos, src + inPos, 8);
+                outPos += group->literals[i];
+                inPos += group->literals[i];
+
+                length = src[inPos] >> 2;
+                offset = ((src[inPos] & 0x03) << 8) | src[inPos + 1];
+                inPos += 2;
+                CopyMatchWide(dst, outPos,
+                    (offset == 0) ? WINDOW_SIZE : offset, length);
+                outPos += length;
+            }
+
+            memcpy(dst + outPos, src + inPos, 8);
+            outPos += group->literals[i];
+            inPos += group->literals[i];
+            continue;
+        }
+
+        for (flagPos = 0x80; flagPos != 0; flagPos >>= 1)
+        {
+            if ((flags & flagPos) == 0)
+            {
+                /* uncoded character */
+                if (inPos >= table->srcLen)
+                {
+                    break;
+                }
+
+                dst[outPos++] = src[inPos++];
+                continue;
+            }
+
+            /* offset and length */
+            if (inPos + 1 >= table->srcLen)
+            {
+                break;
+            }
+
+            length = src[inPos] >> 2;
+            offset = ((src[inPos] & 0x03) << 8) | src[inPos + 1];
+            inPos += 2;
+            CopyMatch(dst, outPos, (offset == 0) ? WINDOW_SIZE : offset,
+                length);
+            outPos += length;
+        }
+
+        if (flagPos != 0)
+        {
+            break;
+        }
+    }
+
+    chunk->outEnd = outPos;
+}
+
+/****************************************************************************
+*   Function   : DecodedByte
+*   Description: This function finds the final value of a decoded byte
+*                while the output still holds window symbol placeholders,
+*                from the window of the chunk the byte is in.  That window
+*                must already be set.
+*   Parameters : table - the decode table
+*                chunk - a chunk the byte is in or after
+*                pos - position of the byte in the output
+*   Effects    : NONE
+*   Returned   : The byte, 0x11 before the start of the output.
+****************************************************************************/
+unsigned char DecodedByte(const decode_table_t *table, long chunk, long pos)
+{
+    const decode_chunk_t *owner;
+    long i;
+
+    if (pos < 0)
+    {
+        return 0x11;
+    }
+
+    while (table->chunks[chunk].outPos > pos)
+    {
+        chunk--;
+    }
+
+    owner = &table->chunks[chunk];
+    i = pos - owner->outPos;
+
+    if (i < owner->symbolCount && owner->symbols[i] >= 256)
+    {
+        return table->windows[chunk * WINDOW_SIZE + owner->symbols[i] - 256];
+    }
+
+    return table->dst[pos];
+}
+
+/****************************************************************************
+*   Function   : ResolveTask
+*   Description: This function replaces the window symbol placeholders of
+*                one chunk with the bytes from its window.
+*   Parameters : context - the decode table
+*                task - number of the chunk to resolve
+*                worker - number of the worker doing the task
+*   Effects    : The chunk's output is complete and its symbols are freed
+*   Returned   : NONE
+****************************************************************************/
+void ResolveTask(void *context, long task, int worker)
+{
+    decode_table_t *table = (decode_table_t *)context;
+    decode_chunk_t *chunk;
+    const unsigned char *window;
+    long i;
+
+    (void)worker;
+    chunk = &table->chunks[task];
+    window = table->windows + task * WINDOW_SIZE;
+
+    for (i = 0; i < chunk->symbolCount; i++)
+    {
+        if (chunk->symbols[i] >= 256)
+        {
+            table->dst[chunk->outPos + i] = window[chunk->symbols[i] - 256];
+        }
+    }
+
+    free(chunk->symbols);
+    chunk->symbols = NULL;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSParallel
+*   Description: This function decodes an encoded buffer on a pool of
+*                threads.  The first pass splits it into chunks at group
+*                boundaries and adds up the bytes before each chunk from
+*                the codes alone, so every chunk knows where its output
+*                goes.  The second decodes the chunks in parallel, keeping
+*                the bytes copied from before a chunk as references to its
+*                window.  Then the windows are filled in chunk order, each
+*                from the one before, WINDOW_SIZE bytes per chunk, and
+*                last the references are replaced in parallel.  The output
+*                is the same as from DecodeLZSSPartial.  With fewer than
+*                DECODE_MIN_THREADS chunks to share out, the chunks are
+*                decoded with DecodeLZSSPartial instead, which is faster.
+*   Parameters : src - encoded data
+*                srcLen - number of bytes in src
+*                threads - number of threads to decode with
+*                size - set to the number of bytes decoded
+*   Effects    : NONE
+*   Returned   : The decoded data, which the caller must free, or NULL if
+*                memory couldn't be allocated.
+****************************************************************************/
+unsigned char *DecodeLZSSParallel(const unsigned char *src, long srcLen,
+    int threads, long *size)
+{
+    decode_table_t table;
+    decode_end_t end;
+    long i, j;
+    int failed;
+
+    BuildFlagGroups();
+    table.src = src;
+    table.srcLen = srcLen;
+
+    if (!SplitDecodeChunks(&table))
+    {
+        return NULL;
+    }
+
+    table.dst = (unsigned char *)malloc(table.dstCap + 1);
+    failed = (table.dst == NULL);
+
+    if (!failed && table.chunkCount < DECODE_MIN_THREADS)
+    {
+        /* too few chunks to make up for the extra passes */
+        *size = DecodeLZSSPartial(src, srcLen, table.dst, table.dstCap,
+            &end);
+        free(table.chunks);
+        free(table.windows);
+        return table.dst;
+    }
+
+    if (!failed)
+    {
+        RunThreadPool(threads, table.chunkCount, ExpandTask, &table);
+    }
+
+    for (i = 0; i < table.chunkCount; i++)
+    {
+        failed |= table.chunks[i].failed;
+    }
+
+    if (!failed)
+    {
+        for (i = 1; i < table.chunkCount; i++)
+        {
+            for (j = 0; j < WINDOW_SIZE; j++)
+            {
+                table.windows[i * WINDOW_SIZE + j] = DecodedByte(&table,
+                    i - 1, table.chunks[i].outPos - WINDOW_SIZE + j);
+            }
+        }
+
+        RunThreadPool(threads, table.chunkCount, ResolveTask, &table);
+    }
+
+    for (i = 0; i < table.chunkCount; i++)
+    {
+        free(table.chunks[i].symbols);
+    }
+
+    *size = table.chunks[table.chunkCount - 1].outEnd;
+    free(table.chunks);
+    free(table.windows);
+
+    if (failed)
+    {
+        free(table.dst);
+        return NULL;
+    }
+
+    return table.dst;
+}
+
+/****************************************************************************
+*   Function   : DecodeGroup
+*   Description: This function decodes one whole group from its FlagGroups
+*                entry, as DecodeLZSSPartial does while there is room.
+*   Parameters : src - encoded data, with GROUP_INPUT bytes after the
+*                      group's flag byte
+*                dst - decoded data, with room for GROUP_OUTPUT bytes
+*                inPos - the group's flag byte, set to the next one
+*                outPos - position the group decodes to, set to its end
+*   Effects    : The group is decoded, with wide copy slack past its end
+*   Returned   : NONE
+****************************************************************************/
+void DecodeGroup(const unsigned char *src, unsigned char *dst, long *inPos,
+    long *outPos)
+{
+    const flag_group_t *group;
+    long in, out;
+    int length, offset, i;
+
+    in = *inPos;
+    out = *outPos;
+    group = &FlagGroups[src[in++]];
+
+    for (i = 0; i < group->matches; i++)
+    {
+        memcpy(dst + out, src + in, 8);
+        out += group->literals[i];
+        in += group->literals[i];
+
+        length = src[in] >> 2;
+        offset = ((src[in] & 0x03) << 8) | src[in + 1];
+        in += 2;
+        CopyMatchWide(dst, out, (offset == 0) ? WINDOW_SIZE : offset,
+            length);
+        out += length;
+    }
+
+    memcpy(dst + out, src + in, 8);
+    *inPos = in + group->literals[i];
+    *outPos = out + group->literals[i];
+}
+
+/****************************************************************************
+*   Function   : InitStreamDecoder
+*   Description: This function sets up a decoder for data that arrives a
+*                piece at a time.  It decodes into a STREAM_WINDOW buffer
+*                that starts with HISTORY_SIZE bytes of 0x11, the contents
+*                of the eb_ecl.exe ring before anything is decoded, and
+*                holds at most one byte of input between feeds.
+*   Parameters : decoder - decoder to set up
+*   Effects    : decoder is ready for FeedStreamDecoder
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int InitStreamDecoder(stream_decoder_t *decoder)
+{
+    BuildFlagGroups();
+    decoder->window = (unsigned char *)malloc(STREAM_WINDOW);
+
+    if (decoder->window == NULL)
+    {
+        return FALSE;
+    }
+
+    memset(decoder->window, 0x11, HISTORY_SIZE);
+    decoder->windowPos = HISTORY_SIZE;
+    decoder->drainPos = HISTORY_SIZE;
+    decoder->input = NULL;
+    decoder->inputSize = 0;
+    decoder->inputPos = 0;
+    decoder->flags = 0;
+    decoder->flagPos = 0;
+    decoder->carried = FALSE;
+    decoder->carry = 0;
+    decoder->digest = NULL;
+    decoder->index = NULL;
+    decoder->decodedBase = -HISTORY_SIZE;
+    decoder->encodedBase = 0;
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : FreeStreamDecoder
+*   Description: This function frees what InitStreamDecoder allocated.
+*   Parameters : decoder - decoder to free
+*   Effects    : decoder may no longer be used
+*   Returned   : NONE
+****************************************************************************/
+void FreeStreamDecoder(stream_decoder_t *decoder)
+{
+    free(decoder->window);
+    decoder->window = NULL;
+}
+
+/****************************************************************************
+*   Function   : FeedStreamDecoder
+*   Description: This function gives a decoder the next piece of encoded
+*                data.  It isn't copied: it must stay unchanged until
+*                DrainStreamDecoder returns less than it was asked for,
+*                which is when all of it has been decoded.  A piece may
+*                end anywhere, including inside a group or a code.
+*   Parameters : decoder - decoder to feed
+*                data - encoded data following the last piece fed
+*                size - number of bytes in data
+*   Effects    : The data is decoded by the following drains
+*   Returned   : NONE
+****************************************************************************/
+void FeedStreamDecoder(stream_decoder_t *decoder, const unsigned char *data,
+    long size)
+{
+    decoder->encodedBase += decoder->inputSize;
+    decoder->input = data;
+    decoder->inputSize = size;
+    decoder->inputPos = 0;
+}
+
+/****************************************************************************
+*   Function   : StreamDecodeTokens
+*   Description: This function decodes the data fed to a stream decoder
+*                into its window until the window is nearly full or the
+*                data runs out.  Groups whose input has all arrived are
+*                decoded by DecodeGroup, as DecodeLZSSPartial does, and the
+*                group split by the end of the data a token at a time.
+*                Checkpoints are added to the decoder's index, if it has
+*                one, at the groups they fall due on.
+*   Parameters : decoder - decoder to decode with
+*   Effects    : Decoded bytes are added to the window
+*   Returned   : NONE
+****************************************************************************/
+void StreamDecodeTokens(stream_decoder_t *decoder)
+{
+    const unsigned char *src;
+    unsigned char *window;
+    long inPos, outPos;
+    int length, offset;
+
+    src = decoder->input;
+    window = decoder->window;
+    inPos = decoder->inputPos;
+    outPos = decoder->windowPos;
+
+    while (outPos + MAX_LENGTH <= STREAM_WINDOW)
+    {
+        if (decoder->flagPos == 0)
+        {
+            if (decoder->index != NULL &&
+                decoder->decodedBase + outPos >= decoder->index->next)
+            {
+                AddCheckpoint(decoder->index, window + outPos,
+                    decoder->decodedBase + outPos,
+                    decoder->encodedBase + inPos);
+            }
+
+            if (decoder->inputSize - inPos > GROUP_INPUT &&
+                outPos + GROUP_OUTPUT <= STREAM_WINDOW)
+            {
+                DecodeGroup(src, window, &inPos, &outPos);
+                continue;
+            }
+
+            if (inPos >= decoder->inputSize)
+            {
+                break;
+            }
+
+            decoder->flags = src[inPos++];
+            decoder->flagPos = 0x80;
+        }
+
+        if ((decoder->flags & decoder->flagPos) == 0)
+        {
+            /* uncoded character */
+            if (inPos >= decoder->inputSize)
+            {
+                break;
+            }
+
+            window[outPos++] = src[inPos++];
+            decoder->flagPos >>= 1;
+            continue;
+        }
+
+        /* offset and length */
+        if (!decoder->carried)
+        {
+            if (inPos >= decoder->inputSize)
+            {
+                break;
+            }
+
+            decoder->carry = src[inPos++];
+            decoder->carried = TRUE;
+        }
+
+        if (inPos >= decoder->inputSize)
+        {
+            break;
+        }
+
+        length = decoder->carry >> 2;
+        offset = ((decoder->carry & 0x03) << 8) | src[inPos++];
+        decoder->carried = FALSE;
+        CopyMatch(window, outPos, (offset == 0) ? WINDOW_SIZE : offset,
+            length);
+        outPos += length;
+        decoder->flagPos >>= 1;
+    }
+
+    decoder->inputPos = inPos;
+    decoder->windowPos = outPos;
+}
+
+/****************************************************************************
+*   Function   : DrainStreamDecoder
+*   Description: This function copies out the bytes a decoder has decoded
+*                and decodes more of the data fed to it, until the output
+*                buffer is full or the data runs out.  Once everything in
+*                the window has been drained, the last HISTORY_SIZE bytes
+*                are moved back to its start to make room, so matches
+*                always read from the window and never need their own
+*                bounds checks.  Draining all of a stream in any pieces
+*                gives the same bytes as DecodeLZSSPartial.
+*   Parameters : decoder - decoder to drain
+*                out - buffer for the decoded data
+*                cap - number of bytes out can hold
+*   Effects    : The decoded data is written to out
+*   Returned   : The number of bytes drained, less than cap once the data
+*                fed has all been decoded.  The decoder's digest, if it
+*                has one, is updated with the bytes drained.
+****************************************************************************/
+long DrainStreamDecoder(stream_decoder_t *decoder, unsigned char *out,
+    long cap)
+{
+    long outPos, pending, decoded;
+
+    outPos = 0;
+
+    for (;;)
+    {
+        pending = decoder->windowPos - decoder->drainPos;
+
+        if (pending > cap - outPos)
+        {
+            pending = cap - outPos;
+        }
+
+        memcpy(out + outPos, decoder->window + decoder->drainPos, pending);
+
+        if (decoder->digest != NULL)
+        {
+            /* while the bytes are still in the cache */
+            UpdateDigest(decoder->digest, out + outPos, pending);
+        }
+
+        decoder->drainPos += pending;
+        outPos += pending;
+
+        if (decoder->drainPos < decoder->windowPos)
+        {
+            /* out is full */
+            break;
+        }
+
+        if (decoder->windowPos + GROUP_OUTPUT > STREAM_WINDOW)
+        {
+            memmove(decoder->window,
+                decoder->window + decoder->windowPos - HISTORY_SIZE,
+                HISTORY_SIZE);
+            decoder->decodedBase += decoder->windowPos - HISTORY_SIZE;
+            decoder->windowPos = HISTORY_SIZE;
+            decoder->drainPos = HISTORY_SIZE;
+        }
+
+        decoded = decoder->windowPos;
+        StreamDecodeTokens(decoder);
+
+        if (decoder->windowPos == decoded)
+        {
+            /* all of the data fed has been decoded */
+            break;
+        }
+    }
+
+    return outPos;
+}
+
+/****************************************************************************
+*   Function   : InitDigest
+*   Description: This function starts digests of data that is handed to
+*                UpdateDigest a piece at a time.
+*   Parameters : digest - digests to start
+*                digests - DIGEST_ bits of the digests to compute, 0 for
+*                          none
+*   Effects    : digest is ready for UpdateDigest
+*   Returned   : NONE
+****************************************************************************/
+void InitDigest(digest_t *digest, int digests)
+{
+    static const uint32_t initial[8] =
+    {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+        0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+
+    digest->digests = digests;
+    digest->crc = 0xFFFFFFFF;
+    memcpy(digest->state, initial, sizeof(initial));
+    digest->blockSize = 0;
+    digest->length = 0;
+
+    if (digests & DIGEST_CRC32)
+    {
+        BuildCrcTable();
+    }
+
+    if (digests & DIGEST_SHA256)
+    {
+        SelectKernels();
+    }
+}
+
+/****************************************************************************
+*   Function   : UpdateDigest
+*   Description: This function adds the next piece of data to the digests.
+*                Decoders call it with each piece of output as soon as it
+*                is decoded, so the data is hashed from the cache instead
+*                of being read again afterwards.
+*   Parameters : digest - digests from InitDigest
+*                data - data following the data already added
+*                size - number of bytes in data
+*   Effects    : The digests take in data
+*   Returned   : NONE
+****************************************************************************/
+void UpdateDigest(digest_t *digest, const unsigned char *data, long size)
+{
+    long blocks;
+    int fill;
+
+    if (digest->digests & DIGEST_CRC32)
+    {
+        digest->crc = UpdateCrc32(digest->crc, data, size);
+    }
+
+    if ((digest->digests & DIGEST_SHA256) == 0)
+    {
+        return;
+    }
+
+    digest->length += size;
+
+    if (digest->blockSize > 0)
+    {
+        /* complete the block left over from the last piece */
+        fill = 64 - digest->blockSize;
+
+        if (fill > size)
+        {
+            fill = (int)size;
+        }
+
+        memcpy(digest->block + digest->blockSize, data, fill);
+        digest->blockSize += fill;
+        data += fill;
+        size -= fill;
+
+        if (digest->blockSize < 64)
+        {
+            return;
+        }
+
+        Sha256Blocks(digest->state, digest->block, 1);
+        digest->blockSize = 0;
+    }
+
+    blocks = size / 64;
+    Sha256Blocks(digest->state, data, blocks);
+    memcpy(digest->block, data + blocks * 64, size - blocks * 64);
+    digest->blockSize = (int)(size - blocks * 64);
+}
+
+/****************************************************************************
+*   Function   : FinishDigest
+*   Description: This function ends the digests of the data added to them.
+*   Parameters : digest - digests from InitDigest, which can't be updated
+*                         again
+*                sha256 - set to the 32 byte SHA-256 hash, if it was asked
+*                         for
+*   Effects    : The SHA-256 hash is padded out and written to sha256
+*   Returned   : The CRC-32 of the data, if it was asked for.
+****************************************************************************/
+unsigned long FinishDigest(digest_t *digest, unsigned char *sha256)
+{
+    unsigned long long bits;
+    int i;
+
+    if (digest->digests & DIGEST_SHA256)
+    {
+        bits = digest->length * 8;
+        digest->block[digest->blockSize++] = 0x80;
+
+        if (digest->blockSize > 56)
+        {
+            memset(digest->block + digest->blockSize, 0,
+                64 - digest->blockSize);
+            Sha256Blocks(digest->state, digest->block, 1);
+            digest->blockSize = 0;
+        }
+
+        memset(digest->block + digest->blockSize, 0, 56 - digest->blockSize);
+
+        for (i = 0; i < 8; i++)
+        {
+            digest->block[63 - i] = (unsigned char)(bits >> (8 * i));
+        }
+
+        Sha256Blocks(digest->state, digest->block, 1);
+
+        for (i = 0; i < 32; i++)
+        {
+            sha256[i] = (unsigned char)(digest->state[i / 4] >>
+                (24 - 8 * (i % 4)));
+        }
+    }
+
+    return (unsigned long)(digest->crc ^ 0xFFFFFFFF);
+}
+
+/****************************************************************************
+*   Function   : ReportDigest
+*   Description: This function ends the digests of the data added to them
+*                and prints the ones asked for, in hex.
+*   Parameters : digest - digests from InitDigest
+*                outFile - file to print them to
+*   Effects    : The digests are printed to outFile
+*   Returned   : NONE
+****************************************************************************/
+void ReportDigest(digest_t *digest, FILE *outFile)
+{
+    unsigned char sha256[32];
+    unsigned long crc;
+    int i;
+
+    crc = FinishDigest(digest, sha256);
+
+    if (digest->digests & DIGEST_CRC32)
+    {
+        fprintf(outFile, "crc32 %08lx\n", crc);
+    }
+
+    if (digest->digests & DIGEST_SHA256)
+    {
+        fprintf(outFile, "sha256 ");
+
+        for (i = 0; i < 32; i++)
+        {
+            fprintf(outFile, "%02x", sha256[i]);
+        }
+
+        fprintf(outFile, "\n");
+    }
+}
+
+/****************************************************************************
+*   Function   : BuildCrcTable
+*   Description: This function fills CrcTable for UpdateCrc32.  Row 0 is
+*                the usual byte at a time CRC-32 table (the reflected
+*                0xEDB88320 polynomial of zip and Ethernet), and row k the
+*                CRC of a byte followed by k zero bytes, so 8 bytes can be
+*                taken in with 8 independent lookups.
+*   Parameters : NONE
+*   Effects    : CrcTable is filled in
+*   Returned   : NONE
+****************************************************************************/
+void BuildCrcTable(void)
+{
+    uint32_t crc;
+    int value, bit, row;
+
+    if (CrcTable[0][1] != 0)
+    {
+        /* already built */
+        return;
+    }
+
+    for (value = 0; value < 256; value++)
+    {
+        crc = (uint32_t)value;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+
+        CrcTable[0][value] = crc;
+    }
+
+    for (value = 0; value < 256; value++)
+    {
+        crc = CrcTable[0][value];
+
+        for (row = 1; row < 8; row++)
+        {
+            crc = (crc >> 8) ^ CrcTable[0][crc & 0xFF];
+            CrcTable[row][value] = crc;
+        }
+    }
+}
+
+/****************************************************************************
+*   Function   : UpdateCrc32
+*   Description: This function takes data into a CRC-32, 8 bytes at a
+*                time (slicing by 8).
+*   Parameters : crc - CRC so far, inverted, 0xFFFFFFFF to start
+*                data - data to take in
+*                size - number of bytes in data
+*   Effects    : NONE
+*   Returned   : The CRC after data, still inverted.
+****************************************************************************/
+uint32_t UpdateCrc32(uint32_t crc, const unsigned char *data, long size)
+{
+    uint32_t low, high;
+
+    while (size >= 8)
+    {
+        low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+            ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+        high = (uint32_t)data[4] | ((uint32_t)data[5] << 8) |
+            ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+        crc = CrcTable[7][low & 0xFF] ^ CrcTable[6][(low >> 8) & 0xFF] ^
+            CrcTable[5][(low >> 16) & 0xFF] ^ CrcTable[4][low >> 24] ^
+            CrcTable[3][high & 0xFF] ^ CrcTable[2][(high >> 8) & 0xFF] ^
+            CrcTable[1][(high >> 16) & 0xFF] ^ CrcTable[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ CrcTable[0][(crc ^ *data) & 0xFF];
+        data++;
+        size--;
+    }
+
+    return crc;
+}
+
+/* SHA-256 round constants */
+static const uint32_t Sha256K[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+/****************************************************************************
+*   Function   : Sha256BlocksScalar
+*   Description: This function runs the SHA-256 compression function over
+*                whole 64 byte blocks.
+*   Parameters : state - the 8 word hash state
+*                data - blocks to hash
+*                blocks - number of blocks in data
+*   Effects    : state takes in the blocks
+*   Returned   : NONE
+****************************************************************************/
+void Sha256BlocksScalar(uint32_t *state, const unsigned char *data,
+    long blocks)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (; blocks > 0; blocks--, data += 64)
+    {
+        for (i = 0; i < 16; i++)
+        {
+            w[i] = ((uint32_t)data[4 * i] << 24) |
+                ((uint32_t)data[4 * i + 1] << 16) |
+                ((uint32_t)data[4 * i + 2] << 8) | (uint32_t)data[4 * i + 3];
+        }
+
+        for (i = 16; i < 64; i++)
+        {
+            t1 = w[i - 2];
+            t2 = w[i - 15];
+            w[i] = (ROTR32(t1, 17) ^ ROTR32(t1, 19) ^ (t1 >> 10)) + w[i - 7] +
+                (ROTR32(t2, 7) ^ ROTR32(t2, 18) ^ (t2 >> 3)) + w[i - 16];
+        }
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        for (i = 0; i < 64; i++)
+        {
+            t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+                ((e & f) ^ (~e & g)) + Sha256K[i] + w[i];
+            t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+                ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/****************************************************************************
+*   Function   : Sha256BlocksSHA
+*   Description: SHA extensions version of Sha256BlocksScalar.  The state
+*                is kept as the ABEF and CDGH halves the round instruction
+*                works on, and each instruction runs two rounds.
+*   Parameters : state - the 8 word hash state
+*                data - blocks to hash
+*                blocks - number of blocks in data
+*   Effects    : state takes in the blocks
+*   Returned   : NONE
+****************************************************************************/
+__attribute__((target("sha,sse4.1")))
+void Sha256BlocksSHA(uint32_t *state, const unsigned char *data,
+    long blocks)
+{
+    __m128i abef, cdgh, savedAbef, savedCdgh, words[4], msg, tmp, swap;
+    int i;
+
+    swap = _mm_set_epi64x(0x0C0D0E0F08090A0BLL, 0x0405060700010203LL);
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)),
+        0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; blocks > 0; blocks--, data += 64)
+    {
+        savedAbef = abef;
+        savedCdgh = cdgh;
+
+        for (i = 0; i < 4; i++)
+        {
+            words[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)(data + 16 * i)), swap);
+        }
+
+        /* 4 rounds at a time, words holds the next 16 schedule words */
+        for (i = 0; i < 16; i++)
+        {
+            msg = _mm_add_epi32(words[i & 3],
+                _mm_loadu_si128((const __m128i *)(Sha256K + 4 * i)));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+
+            if (i < 12)
+            {
+                tmp = _mm_alignr_epi8(words[(i + 3) & 3], words[(i + 2) & 3],
+                    4);
+                words[i & 3] = _mm_add_epi32(_mm_sha256msg1_epu32(
+                    words[i & 3], words[(i + 1) & 3]), tmp);
+                words[i & 3] = _mm_sha256msg2_epu32(words[i & 3],
+                    words[(i + 3) & 3]);
+            }
+
+            abef = _mm_sha256rnds2_epu32(abef, cdgh,
+                _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        abef = _mm_add_epi32(abef, savedAbef);
+        cdgh = _mm_add_epi32(cdgh, savedCdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif
+
+/****************************************************************************
+*   Function   : InitCheckpointIndex
+*   Description: This function sets up an empty checkpoint index.
+*   Parameters : index - index to set up
+*                interval - decoded bytes between checkpoints
+*   Effects    : index is ready for AddCheckpoint
+*   Returned   : NONE
+****************************************************************************/
+void InitCheckpointIndex(checkpoint_index_t *index, long interval)
+{
+    index->interval = interval;
+    index->count = 0;
+    index->capacity = 0;
+    index->next = 0;
+    index->positions = NULL;
+    index->windows = NULL;
+    index->failed = FALSE;
+}
+
+/****************************************************************************
+*   Function   : FreeCheckpointIndex
+*   Description: This function frees the checkpoints of an index.
+*   Parameters : index - index to free
+*   Effects    : index may no longer be used
+*   Returned   : NONE
+****************************************************************************/
+void FreeCheckpointIndex(checkpoint_index_t *index)
+{
+    free(index->positions);
+    free(index->windows);
+    index->positions = NULL;
+    index->windows = NULL;
+}
+
+/****************************************************************************
+*   Function   : AddCheckpoint
+*   Description: This function records where a group starts in the
+*                encoded and decoded data, and the WINDOW_SIZE decoded
+*                bytes before it, which are all the group's matches can
+*                read.  With those a stream decoder can start at the group
+*                as if it had decoded everything before it.  The next
+*                checkpoint is due at the next multiple of the interval.
+*   Parameters : index - index to add to
+*                decoded - decoded data at decodedPos, with the bytes
+*                          before it up to WINDOW_SIZE back
+*                decodedPos - position of the group in the decoded data
+*                encodedPos - position of its flag byte
+*   Effects    : The checkpoint is added, or failed is set if there is no
+*                memory for it
+*   Returned   : NONE
+****************************************************************************/
+void AddCheckpoint(checkpoint_index_t *index, const unsigned char *decoded,
+    long decodedPos, long encodedPos)
+{
+    long *positions;
+    unsigned char *windows, *window;
+    long capacity, have;
+
+    if (index->failed)
+    {
+        return;
+    }
+
+    if (index->count == index->capacity)
+    {
+        capacity = (index->capacity == 0) ? 64 : index->capacity * 2;
+        positions = (long *)realloc(index->positions,
+            capacity * 2 * sizeof(long));
+
+        if (positions != NULL)
+        {
+            index->positions = positions;
+        }
+
+        windows = (unsigned char *)realloc(index->windows,
+            capacity * WINDOW_SIZE);
+
+        if (windows != NULL)
+        {
+            index->windows = windows;
+        }
+
+        if (positions == NULL || windows == NULL)
+        {
+            index->failed = TRUE;
+            return;
+        }
+
+        index->capacity = capacity;
+    }
+
+    /* 0x11 before the start of the output, as in the eb_ecl.exe ring */
+    window = index->windows + index->count * WINDOW_SIZE;
+    have = (decodedPos < WINDOW_SIZE) ? decodedPos : WINDOW_SIZE;
+    memset(window, 0x11, WINDOW_SIZE - have);
+    memcpy(window + WINDOW_SIZE - have, decoded - have, have);
+
+    index->positions[2 * index->count] = decodedPos;
+    index->positions[2 * index->count + 1] = encodedPos;
+    index->count++;
+    index->next = (decodedPos / index->interval + 1) * index->interval;
+}
+
+/****************************************************************************
+*   Function   : IndexGroups
+*   Description: This function adds checkpoints to an index for encoded
+*                data already decoded, finding the groups they fall due on
+*                from the codes alone as ProbeLZSSBuffer does.  It stops
+*                GROUP_INPUT bytes before the end of the encoded data, and
+*                at the end of the decoded data.
+*   Parameters : index - index to add to
+*                src - encoded data, starting with a flag byte
+*                srcLen - number of bytes in src
+*                decoded - the data src decodes to
+*                decodedLen - number of bytes in decoded
+*   Effects    : Checkpoints are added to the index
+*   Returned   : NONE
+****************************************************************************/
+void IndexGroups(checkpoint_index_t *index, const unsigned char *src,
+    long srcLen, const unsigned char *decoded, long decodedLen)
+{
+    long inPos, outPos;
+
+    BuildFlagGroups();
+    inPos = 0;
+    outPos = 0;
+
+    while (srcLen - inPos > GROUP_INPUT && outPos <= decodedLen)
+    {
+        if (outPos >= index->next)
+        {
+            AddCheckpoint(index, decoded + outPos, outPos, inPos);
+        }
+
+        outPos += GroupOutput(src + inPos);
+        inPos += 1 + FlagGroups[src[inPos]].size;
+    }
+}
+
+/****************************************************************************
+*   Function   : FindCheckpoint
+*   Description: This function finds the last checkpoint of an index at or
+*                before a decoded position.
+*   Parameters : index - index to search
+*                decodedPos - decoded position to find
+*   Effects    : NONE
+*   Returned   : The number of the checkpoint, or -1 if there isn't one.
+****************************************************************************/
+long FindCheckpoint(const checkpoint_index_t *index, long decodedPos)
+{
+    long low, high, middle;
+
+    /* the answer is below high and at or above low */
+    low = -1;
+    high = index->count;
+
+    while (high - low > 1)
+    {
+        middle = low + (high - low) / 2;
+
+        if (index->positions[2 * middle] <= decodedPos)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/****************************************************************************
+*   Function   : SeekStreamDecoder
+*   Description: This function puts a stream decoder in the state it had
+*                at a checkpoint.  The data fed to it next must start at
+*                the checkpoint's encoded position.
+*   Parameters : decoder - decoder from InitStreamDecoder
+*                index - index holding the checkpoint
+*                checkpoint - number of the checkpoint
+*   Effects    : The decoder carries on from the checkpoint
+*   Returned   : NONE
+****************************************************************************/
+void SeekStreamDecoder(stream_decoder_t *decoder,
+    const checkpoint_index_t *index, long checkpoint)
+{
+    memcpy(decoder->window + HISTORY_SIZE - WINDOW_SIZE,
+        index->windows + checkpoint * WINDOW_SIZE, WINDOW_SIZE);
+    decoder->windowPos = HISTORY_SIZE;
+    decoder->drainPos = HISTORY_SIZE;
+    decoder->decodedBase = index->positions[2 * checkpoint] - HISTORY_SIZE;
+    decoder->encodedBase = index->positions[2 * checkpoint + 1];
+    decoder->input = NULL;
+    decoder->inputSize = 0;
+    decoder->inputPos = 0;
+    decoder->flags = 0;
+    decoder->flagPos = 0;
+    decoder->carried = FALSE;
+}
+
+/****************************************************************************
+*   Function   : WriteCheckpointIndex
+*   Description: This function writes an index to a file: INDEX_MAGIC, the
+*                interval and the number of checkpoints, then for each the
+*                decoded and encoded positions and its window.  Numbers
+*                are 8 bytes, least significant first.
+*   Parameters : index - index to write
+*                outFile - file to write it to
+*   Effects    : The index is written to outFile
+*   Returned   : TRUE for success, FALSE if the index is incomplete or
+*                couldn't be written.
+****************************************************************************/
+int WriteCheckpointIndex(const checkpoint_index_t *index, FILE *outFile)
+{
+    long i;
+
+    if (index->failed)
+    {
+        return FALSE;
+    }
+
+    fwrite(INDEX_MAGIC, 1, 8, outFile);
+    WriteIndexValue(outFile, index->interval);
+    WriteIndexValue(outFile, index->count);
+
+    for (i = 0; i < index->count; i++)
+    {
+        WriteIndexValue(outFile, index->positions[2 * i]);
+        WriteIndexValue(outFile, index->positions[2 * i + 1]);
+        fwrite(index->windows + i * WINDOW_SIZE, 1, WINDOW_SIZE, outFile);
+    }
+
+    return !ferror(outFile);
+}
+
+/****************************************************************************
+*   Function   : ReadCheckpointIndex
+*   Description: This function reads an index written by
+*                WriteCheckpointIndex.
+*   Parameters : index - empty index from InitCheckpointIndex
+*                inFile - file to read it from
+*   Effects    : The checkpoints are read into index
+*   Returned   : TRUE for success, FALSE if the file isn't a valid index,
+*                is shorter than its count of checkpoints needs, or memory
+*                couldn't be allocated.
+****************************************************************************/
+int ReadCheckpointIndex(checkpoint_index_t *index, FILE *inFile)
+{
+    struct stat status;
+    char magic[8];
+    long count, start, i;
+
+    if (fread(magic, 1, 8, inFile) != 8 ||
+        memcmp(magic, INDEX_MAGIC, 8) != 0 ||
+        !ReadIndexValue(inFile, &index->interval) ||
+        !ReadIndexValue(inFile, &count) ||
+        index->interval <= 0 || count < 0 ||
+        count >= LONG_MAX / WINDOW_SIZE - 1)
+    {
+        return FALSE;
+    }
+
+    /* a corrupt count mustn't allocate more than the file can hold */
+    if (fstat(fileno(inFile), &status) == 0 && S_ISREG(status.st_mode) &&
+        (start = ftell(inFile)) >= 0 &&
+        (status.st_size - start) / (2 * 8 + WINDOW_SIZE) < count)
+    {
+        return FALSE;
+    }
+
+    index->positions = (long *)malloc((count + 1) * 2 * sizeof(long));
+    index->windows = (unsigned char *)malloc((count + 1) * WINDOW_SIZE);
+
+    if (index->positions == NULL || index->windows == NULL)
+    {
+        return FALSE;
+    }
+
+    index->capacity = count + 1;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!ReadIndexValue(inFile, &index->positions[2 * i]) ||
+            !ReadIndexValue(inFile, &index->positions[2 * i + 1]) ||
+            fread(index->windows + i * WINDOW_SIZE, 1, WINDOW_SIZE,
+            inFile) != WINDOW_SIZE)
+        {
+            return FALSE;
+        }
+
+        /* FindCheckpoint needs them in order */
+        if (index->positions[2 * i] < 0 || index->positions[2 * i + 1] < 0 ||
+            (i > 0 && index->positions[2 * i] < index->positions[2 * i - 2]))
+        {
+            return FALSE;
+        }
+
+        index->count = i + 1;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : WriteIndexValue
+*   Description: This function writes a number to an index file as 8
+*                bytes, least significant first.
+*   Parameters : outFile - file to write to
+*                value - number to write, not negative
+*   Effects    : 8 bytes are written to outFile
+*   Returned   : NONE
+****************************************************************************/
+void WriteIndexValue(FILE *outFile, long value)
+{
+    unsigned long long bits;
+    int i;
+
+    bits = (unsigned long long)value;
+
+    for (i = 0; i < 8; i++)
+    {
+        putc((int)((bits >> (8 * i)) & 0xFF), outFile);
+    }
+}
+
+/****************************************************************************
+*   Function   : ReadIndexValue
+*   Description: This function reads a number written by WriteIndexValue.
+*   Parameters : inFile - file to read from
+*                value - set to the number read
+*   Effects    : 8 bytes are read from inFile
+*   Returned   : TRUE for success, FALSE if the file ended or the number
+*                doesn't fit in a long.
+****************************************************************************/
+int ReadIndexValue(FILE *inFile, long *value)
+{
+    unsigned char bytes[8];
+    unsigned long long bits;
+    int i;
+
+    if (fread(bytes, 1, 8, inFile) != 8)
+    {
+        return FALSE;
+    }
+
+    bits = 0;
+
+    for (i = 7; i >= 0; i--)
+    {
+        bits = (bits << 8) | bytes[i];
+    }
+
+    if (bits > (unsigned long long)LONG_MAX)
+    {
+        return FALSE;
+    }
+
+    *value = (long)bits;
+    return TRUE;
+}
+
+/****************************************************************************
+*   Function   : InitOutputSink
+*   Description: This function sets up an output sink writing to the file
+*                descriptor under a stdio file.  Anything stdio holds for
+*                the file is flushed first, and nothing should be written
+*                to it through stdio until the sink is freed.
+*   Parameters : sink - sink to set up
+*                outFile - file to write to
+*   Effects    : outFile is flushed
+*   Returned   : TRUE for success, FALSE if memory couldn't be allocated.
+****************************************************************************/
+int InitOutputSink(output_sink_t *sink, FILE *outFile)
+{
+    fflush(outFile);
+    sink->fd = fileno(outFile);
+    sink->buffer = (unsigned char *)malloc(SINK_BLOCK);
+    sink->size = 0;
+    sink->capacity = SINK_BLOCK;
+    sink->failed = FALSE;
+    sink->mapped = FALSE;
+    return (sink->buffer != NULL);
+}
+
+/****************************************************************************
+*   Function   : MapOutputSink
+*   Description: This function swaps the buffer of a new sink for its file
+*                mapped into memory, when the file is an empty regular file
+*                and an upper bound on what will be written is known.  The
+*                file is allocated to the bound first, so writing to the
+*                mapping can't fail for lack of space, and FreeOutputSink
+*                cuts it to the bytes written.  Everything added to the
+*                sink then goes straight to the page cache.  Pipes and
+*                other files keep the buffer, as does a file opened write
+*                only (such as stdout redirected by the shell), since it
+*                can't be mapped for writing.
+*   Parameters : sink - sink from InitOutputSink with nothing added yet
+*                bound - most bytes that will be added to the sink
+*   Effects    : The file is allocated and mapped
+*   Returned   : TRUE if the file was mapped, otherwise FALSE.
+****************************************************************************/
+int MapOutputSink(output_sink_t *sink, long bound)
+{
+#ifdef _WIN32
+    (void)sink;
+    (void)bound;
+    return FALSE;
+#else
+    struct stat status;
+    void *map;
+
+    /* a shared mapping can only be written if the file is open to read */
+    if ((fcntl(sink->fd, F_GETFL) & O_ACCMODE) != O_RDWR ||
+        fstat(sink->fd, &status) != 0 || !S_ISREG(status.st_mode) ||
+        status.st_size != 0 || lseek(sink->fd, 0, SEEK_CUR) != 0 ||
+        sink->size != 0 || bound <= 0)
+    {
+        return FALSE;
+    }
+
+    if (posix_fallocate(sink->fd, 0, bound) != 0)
+    {
+        return FALSE;
+    }
+
+    map = mmap(NULL, (size_t)bound, PROT_READ | PROT_WRITE, MAP_SHARED,
+        sink->fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        if (ftruncate(sink->fd, 0) != 0)
+        {
+            perror("Writing outFile");
+            sink->failed = TRUE;
+        }
+
+        return FALSE;
+    }
+
+    free(sink->buffer);
+    sink->buffer = (unsigned char *)map;
+    sink->capacity = bound;
+    sink->mapped = TRUE;
+    return TRUE;
+#endif
+}
+
+/****************************************************************************
+*   Function   : FreeOutputSink
+*   Description: This function writes what is left in a sink and frees it.
+*   Parameters : sink - sink to free
+*   Effects    : The sink's buffer is written and freed
+*   Returned   : TRUE if everything written to the sink was written to
+*                its file, otherwise FALSE.
+****************************************************************************/
+int FreeOutputSink(output_sink_t *sink)
+{
+#ifndef _WIN32
+    if (sink->mapped)
+    {
+        munmap(sink->buffer, (size_t)sink->capacity);
+        sink->buffer = NULL;
+
+        /* the file was allocated to the bound, cut it to what was written */
+        if (ftruncate(sink->fd, sink->size) != 0 ||
+            lseek(sink->fd, sink->size, SEEK_SET) < 0)
+        {
+            perror("Writing outFile");
+            sink->failed = TRUE;
+        }
+
+        return !sink->failed;
+    }
+#endif
+
+    FlushOutputSink(sink);
+    free(sink->buffer);
+    sink->buffer = NULL;
+    return !sink->failed;
+}
+
+/****************************************************************************
+*   Function   : FlushOutputSink
+*   Description: This function writes the bytes held by a sink.  A
+*                mapped sink's bytes are already in its file.
+*   Parameters : sink - sink to flush
+*   Effects    : The buffer is written and emptied
+*   Returned   : TRUE if every write so far has succeeded, otherwise FALSE.
+****************************************************************************/
+int FlushOutputSink(output_sink_t *sink)
+{
+    if (sink->mapped)
+    {
+        /* already in the file */
+        return !sink->failed;
+    }
+
+    WriteSinkData(sink, sink->buffer, sink->size);
+    sink->size = 0;
+    return !sink->failed;
+}
+
+/****************************************************************************
+*   Function   : WriteSinkData
+*   Description: This function writes data to a sink's file descriptor,
+*                carrying on after short writes and interrupted calls.
+*                The first failure is reported and later writes skipped.
+*   Parameters : sink - sink to write to
+*                data - bytes to write
+*                size - number of bytes in data
+*   Effects    : data is written to the file
+*   Returned   : NONE
+****************************************************************************/
+void WriteSinkData(output_sink_t *sink, const unsigned char *data,
+    long size)
+{
+    long done, result;
+
+    done = 0;
+
+    while (done < size && !sink->failed)
+    {
+        result = (long)write(sink->fd, data + done, size - done);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            perror("Writing outFile");
+            sink->failed = TRUE;
+            break;
+        }
+
+        done += result;
+    }
+}
+
+/****************************************************************************
+*   Function   : SinkWrite
+*   Description: This function adds bytes to a sink, writing its buffer
+*                out when they don't fit.  Data at least as large as the
+*                buffer is written directly.
+*   Parameters : sink - sink to add to
+*                data - bytes to add
+*                size - number of bytes in data
+*   Effects    : data is buffered or written
+*   Returned   : NONE
+****************************************************************************/
+void SinkWrite(output_sink_t *sink, const unsigned char *data, long size)
+{
+    if (size > sink->capacity - sink->size)
+    {
+        FlushOutputSink(sink);
+
+        if (size >= sink->capacity)
+        {
+            WriteSinkData(sink, data, size);
+            return;
+        }
+    }
+
+    memcpy(sink->buffer + sink->size, data, size);
+    sink->size += size;
+}
+
+/****************************************************************************
+*   Function   : SinkWriteGroup
+*   Description: This function adds a flag byte and the codes following it
+*                to a sink.  The codes are always copied as 16 bytes, so
+*                the copy doesn't depend on the number of codes, and the
+*                bytes past size are overwritten by the next write.
+*   Parameters : sink - sink to add to
+*                flags - flag byte of the group
+*                codes - literals and codes of the group, 16 bytes
+*                        readable
+*                size - number of bytes of codes, at most 16
+*   Effects    : The group is buffered
+*   Returned   : NONE
+****************************************************************************/
+void SinkWriteGroup(output_sink_t *sink, unsigned char flags,
+    const unsigned char *codes, int size)
+{
+    if (sink->capacity - sink->size < 17)
+    {
+        FlushOutputSink(sink);
+    }
+
+    sink->buffer[sink->size] = flags;
+    memcpy(sink->buffer + sink->size + 1, codes, 16);
+    sink->size += 1 + size;
 }
@@ -0,0 +1,239 @@
+#!/bin/sh
+#
+# Decodes valid, truncated and random streams with every decoder path and
+# checks each output byte for byte against plain -d: a pipe with -s, -j 2
+# and -j 8, --size, --probe, --index, and --range slices against slices
+# of the plain output.  --crc32 and --sha256 are checked against gzip's
+# CRC-32 and sha256sum, for whole outputs and ranges.  On the encoding side the mapped -o output, an -o
+# file that was longer, --batch and --manifest are checked against
+# standalone runs.  Any sanitizer report fails the check.
+#
+# usage: tests/check_decoders.sh [path to lzss]
+#
+
+LZSS=${1:-./lzss}
+SRC=$(dirname "$0")/../lzss.c
+TMP=${TMPDIR:-/tmp}/lzss_decode.$$
+failed=0
+
+if [ ! -x "$LZSS" ]; then
+    echo "$LZSS isn't an executable, build it first or name it" >&2
+    exit 2
+fi
+
+mkdir -p "$TMP" || exit 2
+trap 'rm -rf "$TMP"' EXIT
+
+# fail <message>
+fail() {
+    echo "FAIL: $1"
+    failed=1
+}
+
+# lz <arguments>, runs lzss with its messages in $TMP/err, and fails on a
+# sanitizer report whatever the exit status
+lz() {
+    "$LZSS" "$@" 2> "$TMP/err"
+    status=$?
+
+    if grep -q 'Sanitizer\|runtime error' "$TMP/err"; then
+        fail "sanitizer report from lzss $*"
+        cat "$TMP/err"
+    fi
+
+    return $status
+}
+
+# slice <file> <start> <bytes>
+slice() {
+    tail -c +$(($2 + 1)) "$1" | head -c "$3"
+}
+
+# crc32 <file>, the CRC-32 gzip stores least significant byte first
+crc32() {
+    gzip -c < "$1" | tail -c 8 | head -c 4 | od -An -tx1 |
+        awk '{ print $4 $3 $2 $1 }'
+}
+
+# inputs: source text, packed data with few matches, and a 2.5 MB mix of
+# both with fill, large enough for -j 8 to decode in parallel
+cp "$SRC" "$TMP/text"
+lz -c -p -i "$TMP/text" -o "$TMP/noise" || exit 2
+{
+    for i in 1 2 3 4 5 6 7 8; do
+        cat "$TMP/text" "$TMP/noise"
+        head -c $((i * 4096)) /dev/zero | tr '\000' '\377'
+    done
+} > "$TMP/large"
+
+streams=""
+
+for name in text noise large; do
+    for padding in "" "-e" "-p"; do
+        stream="$name$padding"
+        lz -c $padding -i "$TMP/$name" -o "$TMP/$stream.lzss" \
+            --index "$TMP/$stream.cidx" || fail "encoding $stream"
+        streams="$streams $stream"
+    done
+done
+
+# truncated inside a group, and at a few places through the stream
+size=$(wc -c < "$TMP/text.lzss")
+
+for cut in 1 2 3 17 18 $((size / 3)) $((size / 2 + 1)) $((size - 1)); do
+    head -c $cut "$TMP/text.lzss" > "$TMP/cut$cut.lzss"
+    streams="$streams cut$cut"
+done
+
+# random bytes decode to something too
+cp "$TMP/noise" "$TMP/random.lzss"
+head -c 100000 "$TMP/large.lzss" | tail -c 50000 > "$TMP/middle.lzss"
+streams="$streams random middle"
+
+for stream in $streams; do
+    input="$TMP/$stream.lzss"
+    reference="$TMP/$stream.out"
+
+    if ! lz -d -i "$input" -o "$reference"; then
+        fail "$stream doesn't decode"
+        continue
+    fi
+
+    decoded=$(wc -c < "$reference")
+
+    if ! cat "$input" | lz -d -s > "$TMP/out" ||
+        ! cmp -s "$reference" "$TMP/out"; then
+        fail "$stream from a pipe differs from -d"
+    fi
+
+    for threads in 2 8; do
+        if ! lz -d -j $threads -i "$input" -o "$TMP/out" ||
+            ! cmp -s "$reference" "$TMP/out"; then
+            fail "$stream with -j $threads differs from -d"
+        fi
+    done
+
+    # the rest of a valid stream must be padding, others only decode
+    lz -d --size $decoded -i "$input" -o "$TMP/out"
+    status=$?
+
+    if ! cmp -s "$reference" "$TMP/out"; then
+        fail "$stream with --size $decoded differs from -d"
+    fi
+
+    case $stream in
+        text*|noise*|large*)
+            [ $status -eq 0 ] || fail "$stream isn't padded for --size"
+            ;;
+    esac
+
+    if lz -d --size $((decoded + 1)) -i "$input" -o "$TMP/out"; then
+        fail "$stream with --size $((decoded + 1)) didn't fail"
+    fi
+
+    if ! lz --probe -i "$input" -o "$TMP/probe" ||
+        ! grep -q "^Decoded size: $decoded\$" "$TMP/probe"; then
+        fail "$stream --probe doesn't give $decoded bytes"
+    fi
+
+    if ! lz -d --crc32 --sha256 -i "$input" -o "$TMP/out" ||
+        ! grep -q "^crc32 $(crc32 "$reference")\$" "$TMP/err" ||
+        ! grep -q "^sha256 $(sha256sum < "$reference" | cut -c1-64)\$" \
+        "$TMP/err"; then
+        fail "$stream digests differ from gzip and sha256sum"
+    fi
+
+    if ! lz -d --index "$TMP/didx" -i "$input" -o "$TMP/out" ||
+        ! cmp -s "$reference" "$TMP/out"; then
+        fail "$stream with --index differs from -d"
+    fi
+
+    # an index written by the encoder must be the same as the decoder's
+    if [ -f "$TMP/$stream.cidx" ] &&
+        ! cmp -s "$TMP/$stream.cidx" "$TMP/didx"; then
+        fail "$stream index from -c differs from -d"
+    fi
+
+    for range in 0:1 0:$decoded 1:100 65535:2 65536:70000 \
+        $((decoded / 2)):$((decoded / 3)) $((decoded - 1)):1; do
+        start=${range%:*}
+        bytes=${range#*:}
+
+        if [ $start -lt 0 ] || [ $((start + bytes)) -gt $decoded ]; then
+            continue
+        fi
+
+        slice "$reference" $start $bytes > "$TMP/slice"
+
+        for index in "" "--index $TMP/didx"; do
+            if ! lz -d --range $range $index -i "$input" -o "$TMP/out" ||
+                ! cmp -s "$TMP/slice" "$TMP/out"; then
+                fail "$stream --range $range $index differs from -d"
+            fi
+        done
+
+        if ! cat "$input" | lz -d -s --range $range --index "$TMP/didx" \
+            --sha256 > "$TMP/out" || ! cmp -s "$TMP/slice" "$TMP/out"; then
+            fail "$stream --range $range from a pipe differs from -d"
+        fi
+
+        if ! grep -q "^sha256 $(sha256sum < "$TMP/slice" | cut -c1-64)\$" \
+            "$TMP/err"; then
+            fail "$stream --range $range digest differs from sha256sum"
+        fi
+    done
+
+    if lz -d --range $decoded:1 -i "$input" -o "$TMP/out"; then
+        fail "$stream --range past the end didn't fail"
+    fi
+done
+
+# the mapped -o output against the buffered pipe output, also over a
+# longer file the output has to be cut down from
+for name in text noise large; do
+    cat "$TMP/$name" | lz -c -s > "$TMP/piped"
+    cat "$TMP/large" "$TMP/large" > "$TMP/mapped"
+
+    if ! lz -c -i "$TMP/$name" -o "$TMP/mapped" ||
+        ! cmp -s "$TMP/piped" "$TMP/mapped"; then
+        fail "$name mapped output differs from a pipe"
+    fi
+done
+
+# --batch and --manifest against standalone runs
+mkdir "$TMP/batch"
+i=0
+
+for name in text noise large; do
+    for cut in 1 1000 70000 300000; do
+        head -c $cut "$TMP/$name" > "$TMP/batch/$name$cut"
+        lz -c -e -i "$TMP/batch/$name$cut" -o "$TMP/batch/$name$cut.ref"
+        printf '%s\t%s\n' "$TMP/batch/$name$cut" \
+            "$TMP/batch/listed$i" >> "$TMP/manifest"
+        i=$((i + 1))
+    done
+done
+
+if ! lz -c -e -j 3 --batch "$TMP"/batch/*[0-9]; then
+    fail "--batch"
+fi
+
+if ! lz -c -e -j 3 --manifest "$TMP/manifest"; then
+    fail "--manifest"
+fi
+
+while read -r input output; do
+    if ! cmp -s "$input.ref" "$input.lzss"; then
+        fail "$input from --batch differs from a standalone run"
+    fi
+
+    if ! cmp -s "$input.ref" "$output"; then
+        fail "$input from --manifest differs from a standalone run"
+    fi
+done < "$TMP/manifest"
+
+if [ $failed -eq 0 ]; then
+    echo "All decoders match -d"
+fi
+
+exit $failed
@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# Encodes inputs full of byte runs and short period repeats with every match
+# engine and checks each output byte for byte against the original brute
+# force search (-m brute).  The default engine is also run with -v, which
+# checks every match it finds, with -j 2, and from a pipe with -s.  Every
+# output is decoded back to its input.
+#
+# usage: tests/check_engines.sh [path to lzss]
+#
+
+LZSS=${1:-./lzss}
+SRC=$(dirname "$0")/../lzss.c
+TMP=${TMPDIR:-/tmp}/lzss_check.$$
+ENGINES="chain shiftand simd suffix"
+failed=0
+
+if [ ! -x "$LZSS" ]; then
+    echo "$LZSS isn't an executable, build it first or name it" >&2
+    exit 2
+fi
+
+mkdir -p "$TMP" || exit 2
+trap 'rm -rf "$TMP"' EXIT
+
+# run <byte in octal> <length>
+run() {
+    head -c "$2" /dev/zero | tr '\000' "\\$1"
+}
+
+# repeat <period> <length> <offset into the noise>
+repeat() {
+    head -c $(($3 + $1)) "$TMP/noise" | tail -c "$1" > "$TMP/unit"
+
+    while [ $(wc -c < "$TMP/unit") -lt "$2" ]; do
+        cat "$TMP/unit" "$TMP/unit" > "$TMP/unit2"
+        mv "$TMP/unit2" "$TMP/unit"
+    done
+
+    head -c "$2" "$TMP/unit"
+}
+
+# noise <length> <offset>
+noise() {
+    head -c $(($2 + $1)) "$TMP/noise" | tail -c "$1"
+}
+
+# packed source text stands in for data with few matches
+"$LZSS" -c -p -i "$SRC" -o "$TMP/noise" 2> /dev/null || exit 2
+
+# runs from 1 byte to well past MAX_LENGTH, around the window size, and
+# touching the start and end of the input
+{
+    run 377 70
+    for len in 1 2 3 4 5 62 63 64 65 66 67 126 127 128 129 130 1022 1023 \
+        1024 1025 4096 70000; do
+        noise $((len % 50 + 3)) $((len % 4000))
+        run 377 $len
+        run 000 $((len / 2 + 1))
+        text=$(head -c $((len % 9 + 1)) "$SRC" | tail -c 1)
+        run 101 $len
+        printf '%s' "$text"
+    done
+    run 000 200
+} > "$TMP/runs"
+
+# every period up to a little past MAX_LENGTH, each repeated for lengths
+# that end mid period, just past MAX_LENGTH and after several windows
+{
+    for period in 1 2 3 4 5 6 7 8 9 12 15 16 17 31 32 33 48 61 62 63 64 \
+        65 66 100; do
+        for len in $((period * 3 + 1)) 64 65 200 3000 $((20000 + period)); do
+            repeat $period $len $((period * 37 + len))
+            noise 5 $((period + len))
+        done
+    done
+    repeat 4 100000 11
+
+    # periods dividing 63, where a nearer offset than the steady state one
+    # also matches 63 bytes, ending at every point of a token
+    for period in 1 3 7 9 21 63; do
+        extra=0
+        while [ $extra -lt 63 ]; do
+            repeat $period $((200 + extra)) $((period + extra))
+            noise 3 $extra
+            extra=$((extra + 1))
+        done
+    done
+} > "$TMP/periods"
+
+# periods and runs running into each other without noise between them
+{
+    for period in 2 3 4 7 8 16 63; do
+        repeat $period 500 $period
+        run 377 $((period * 10))
+        repeat $period 70 $((period + 1))
+        run 000 $period
+    done
+} > "$TMP/mixed"
+
+# sizes just short of a multiple of 4096, where the suffix engine's block
+# summary ends, and a multiple of it
+for size in 12240 65520 65536; do
+    cat "$TMP/noise" "$TMP/runs" | head -c $size > "$TMP/size$size"
+done
+
+for name in runs periods mixed size12240 size65520 size65536; do
+    input="$TMP/$name"
+
+    for padding in "" "-e" "-p"; do
+        "$LZSS" -c $padding -m brute -i "$input" -o "$TMP/brute" 2> /dev/null
+
+        for args in $(echo $ENGINES | sed 's/[a-z]*/-m:&/g') -v "-j:2"; do
+            args=$(echo $args | tr ':' ' ')
+
+            if ! "$LZSS" -c $padding $args -i "$input" -o "$TMP/out" \
+                2> "$TMP/err" || ! cmp -s "$TMP/brute" "$TMP/out"; then
+                echo "FAIL: $name $padding $args differs from -m brute"
+                cat "$TMP/err"
+                failed=1
+            fi
+        done
+
+        if ! "$LZSS" -c $padding -s < "$input" > "$TMP/out" 2> /dev/null ||
+            ! cmp -s "$TMP/brute" "$TMP/out"; then
+            echo "FAIL: $name $padding from a pipe differs from -m brute"
+            failed=1
+        fi
+
+        if ! "$LZSS" -d -i "$TMP/brute" -o "$TMP/decoded" 2> /dev/null ||
+            ! head -c $(wc -c < "$input") "$TMP/decoded" |
+            cmp -s - "$input"; then
+            echo "FAIL: $name $padding doesn't decode to its input"
+            failed=1
+        fi
+    done
+done
+
+if [ $failed -eq 0 ]; then
+    echo "All engines match the brute force search"
+fi
+
+exit $failed